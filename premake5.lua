@@ -76,6 +76,11 @@ filter { "system:linux", "system:macosx" }
 	linkoptions "-pthread"
 filter {}
 
+-- 64-bit file offsets for pwrite/fallocate on 32-bit targets
+filter "system:linux"
+	defines "_FILE_OFFSET_BITS=64"
+filter {}
+
 if os.istarget("linux") then
 	-- this supports cross-compilation for arm64
 	filter { "toolset:clang*", "platforms:arm64" }
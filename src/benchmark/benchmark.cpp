@@ -0,0 +1,313 @@
+#include <std_include.hpp>
+
+#include <console.hpp>
+
+#include "benchmark.hpp"
+
+#include <utils/compression.hpp>
+#include <utils/crc32.hpp>
+#include <utils/inflate.hpp>
+#include <utils/mapped_file.hpp>
+#include <utils/sha256.hpp>
+
+#include <zlib.h>
+
+namespace benchmark
+{
+	namespace
+	{
+		constexpr std::size_t BUFFER_SIZE = 64 * 1024 * 1024;
+		constexpr std::size_t ROUNDS = 16;
+
+		// A release archive takes a while to inflate
+		constexpr std::size_t INFLATE_ROUNDS = 3;
+
+		// Most entries of a game archive are this small, the cost of every call matters more than throughput there
+		constexpr std::size_t SMALL_ENTRY_SIZE = 2 * 1024;
+		constexpr std::size_t SMALL_ENTRY_COUNT = 4096;
+
+		// Best of several rounds, in MB/s
+		template <typename Callback>
+		double measure(const std::size_t size, Callback&& callback, const std::size_t rounds = ROUNDS)
+		{
+			auto best = std::chrono::steady_clock::duration::max();
+			for (std::size_t i = 0; i < rounds; ++i)
+			{
+				const auto start = std::chrono::steady_clock::now();
+				callback();
+				best = std::min(best, std::chrono::steady_clock::now() - start);
+			}
+
+			const auto seconds = std::chrono::duration<double>(best).count();
+			return static_cast<double>(size) / (1024.0 * 1024.0) / std::max(seconds, 1e-9);
+		}
+
+		std::vector<std::uint8_t> generate_buffer()
+		{
+			std::vector<std::uint8_t> buffer(BUFFER_SIZE);
+
+			std::uint32_t seed = 0x12345678;
+			for (auto& byte : buffer)
+			{
+				seed = seed * 1664525 + 1013904223;
+				byte = static_cast<std::uint8_t>(seed >> 24);
+			}
+
+			return buffer;
+		}
+
+		struct small_entry
+		{
+			std::vector<std::uint8_t> data;
+			std::vector<std::byte> deflated;
+		};
+
+		// Text-like data, it compresses about as well as the scripts and configs in an archive
+		std::optional<std::vector<small_entry>> generate_small_entries()
+		{
+			constexpr const char* words[] = {"level", "weapon", "player", "model", "sound", "damage", "_mp", "\n", "\t", " ", "=", "0", "1", "64"};
+
+			std::vector<small_entry> entries(SMALL_ENTRY_COUNT);
+
+			std::uint32_t seed = 0x12345678;
+			for (auto& entry : entries)
+			{
+				while (entry.data.size() < SMALL_ENTRY_SIZE)
+				{
+					seed = seed * 1664525 + 1013904223;
+					const std::string_view word = words[(seed >> 24) % std::size(words)];
+					entry.data.insert(entry.data.end(), word.begin(), word.end());
+				}
+
+				entry.data.resize(SMALL_ENTRY_SIZE);
+
+				z_stream stream{};
+				if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+				{
+					return {};
+				}
+
+				entry.deflated.resize(deflateBound(&stream, static_cast<uLong>(entry.data.size())));
+				stream.next_in = entry.data.data();
+				stream.avail_in = static_cast<uInt>(entry.data.size());
+				stream.next_out = reinterpret_cast<Bytef*>(entry.deflated.data());
+				stream.avail_out = static_cast<uInt>(entry.deflated.size());
+
+				const auto result = deflate(&stream, Z_FINISH);
+				entry.deflated.resize(entry.deflated.size() - stream.avail_out);
+				deflateEnd(&stream);
+
+				if (result != Z_STREAM_END)
+				{
+					return {};
+				}
+			}
+
+			return {std::move(entries)};
+		}
+
+		struct deflated_entry
+		{
+			const utils::compression::zip::entry_info* info;
+			std::span<const std::byte> data;
+		};
+
+		// The compressed data of every deflated entry, it follows the entry's local header
+		std::optional<std::vector<deflated_entry>> find_deflated_entries(const std::span<const std::byte> archive,
+		                                                                 const std::vector<utils::compression::zip::entry_info>& entries)
+		{
+			constexpr std::size_t LOCAL_HEADER_SIZE = 30;
+
+			std::vector<deflated_entry> result{};
+			for (const auto& entry : entries)
+			{
+				if (entry.method != Z_DEFLATED)
+				{
+					continue;
+				}
+
+				if (entry.local_header_offset > archive.size() || archive.size() - entry.local_header_offset < LOCAL_HEADER_SIZE)
+				{
+					return {};
+				}
+
+				const auto* header = reinterpret_cast<const std::uint8_t*>(archive.data()) + entry.local_header_offset;
+				const auto offset = entry.local_header_offset + LOCAL_HEADER_SIZE + (header[26] | header[27] << 8) + (header[28] | header[29] << 8);
+				if (offset > archive.size() || entry.compressed_size > archive.size() - offset)
+				{
+					return {};
+				}
+
+				result.push_back({&entry, archive.subspan(static_cast<std::size_t>(offset), static_cast<std::size_t>(entry.compressed_size))});
+			}
+
+			return {std::move(result)};
+		}
+	}
+
+	int crc32()
+	{
+		const auto buffer = generate_buffer();
+
+		std::uint32_t accelerated = 0;
+		const auto accelerated_speed = measure(buffer.size(), [&]
+		{
+			accelerated = utils::crc32::update(0, buffer.data(), buffer.size());
+		});
+
+		std::uint32_t reference = 0;
+		const auto reference_speed = measure(buffer.size(), [&]
+		{
+			reference = static_cast<std::uint32_t>(::crc32(0, buffer.data(), static_cast<uInt>(buffer.size())));
+		});
+
+		if (accelerated != reference)
+		{
+			console::error("CRC32 mismatch: %08X (%s) vs %08X (zlib)", accelerated, utils::crc32::get_implementation(), reference);
+			return EXIT_FAILURE;
+		}
+
+		console::info("CRC32 over %zu MiB: %s %.0f MB/s, zlib %.0f MB/s (%.1fx)", buffer.size() / (1024 * 1024),
+		              utils::crc32::get_implementation(), accelerated_speed, reference_speed, accelerated_speed / reference_speed);
+
+		return EXIT_SUCCESS;
+	}
+
+	int sha256()
+	{
+		// FIPS 180-2 test vector, spans two blocks
+		utils::sha256 check{};
+		check.update("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56);
+		if (const auto digest = check.finish_hex();
+			digest != "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1")
+		{
+			console::error("SHA-256 mismatch: %s (%s)", digest.c_str(), utils::sha256::get_implementation());
+			return EXIT_FAILURE;
+		}
+
+		const auto buffer = generate_buffer();
+
+		const auto speed = measure(buffer.size(), [&]
+		{
+			utils::sha256 hash{};
+			hash.update(buffer.data(), buffer.size());
+			(void)hash.finish();
+		});
+
+		console::info("SHA-256 over %zu MiB: %s %.0f MB/s", buffer.size() / (1024 * 1024), utils::sha256::get_implementation(), speed);
+
+		return EXIT_SUCCESS;
+	}
+
+	int inflate(const std::string& archive)
+	{
+		const utils::io::mapped_file mapped_file(archive);
+		if (!mapped_file.is_open())
+		{
+			console::error("Failed to open %s", archive.c_str());
+			return EXIT_FAILURE;
+		}
+
+		const auto data = mapped_file.data();
+		const auto tail = data.last(std::min(data.size(), utils::compression::zip::MAX_END_OF_CENTRAL_DIRECTORY_SIZE));
+
+		const auto directory = utils::compression::zip::find_central_directory(tail, data.size());
+		const auto entries = directory.has_value()
+			                     ? utils::compression::zip::read_central_directory(data.subspan(static_cast<std::size_t>(directory->offset), static_cast<std::size_t>(directory->size)))
+			                     : std::nullopt;
+		const auto deflated = entries.has_value() ? find_deflated_entries(data, *entries) : std::nullopt;
+		if (!deflated.has_value() || deflated->empty())
+		{
+			console::error("%s is not an archive with deflated entries", archive.c_str());
+			return EXIT_FAILURE;
+		}
+
+		std::uint64_t total_size = 0;
+		for (const auto& entry : *deflated)
+		{
+			total_size += entry.info->uncompressed_size;
+		}
+
+		console::info("Inflating %zu entries, %llu MiB", deflated->size(), static_cast<unsigned long long>(total_size / (1024 * 1024)));
+
+		for (const auto& backend : utils::inflate::get_backends())
+		{
+			// Every backend has to get the data right before its speed means anything
+			for (const auto& entry : *deflated)
+			{
+				std::uint32_t crc = 0;
+				std::uint64_t size = 0;
+				const auto result = backend.inflate_raw(entry.data, [&](const std::uint8_t* chunk, const std::size_t length)
+				{
+					crc = utils::crc32::update(crc, chunk, length);
+					size += length;
+					return true;
+				}, nullptr);
+
+				if (!result || crc != entry.info->crc || size != entry.info->uncompressed_size)
+				{
+					console::error("%s failed to inflate \"%s\"", backend.name, entry.info->name.c_str());
+					return EXIT_FAILURE;
+				}
+			}
+
+			const auto speed = measure(static_cast<std::size_t>(total_size), [&]
+			{
+				for (const auto& entry : *deflated)
+				{
+					backend.inflate_raw(entry.data, [](const std::uint8_t*, std::size_t)
+					{
+						return true;
+					}, nullptr);
+				}
+			}, INFLATE_ROUNDS);
+
+			console::info("%s%s: %.0f MB/s", backend.name, &backend == &utils::inflate::get_backend() ? " (selected)" : "", speed);
+		}
+
+		const auto small_entries = generate_small_entries();
+		if (!small_entries.has_value())
+		{
+			console::error("Failed to deflate the small entries");
+			return EXIT_FAILURE;
+		}
+
+		console::info("Inflating %zu entries of %zu bytes", small_entries->size(), SMALL_ENTRY_SIZE);
+
+		for (const auto& backend : utils::inflate::get_backends())
+		{
+			for (const auto& entry : *small_entries)
+			{
+				std::vector<std::uint8_t> output{};
+				const auto result = backend.inflate_raw(entry.deflated, [&](const std::uint8_t* chunk, const std::size_t length)
+				{
+					output.insert(output.end(), chunk, chunk + length);
+					return true;
+				}, nullptr);
+
+				if (!result || output != entry.data)
+				{
+					console::error("%s failed to inflate a small entry", backend.name);
+					return EXIT_FAILURE;
+				}
+			}
+
+			const auto speed = measure(small_entries->size() * SMALL_ENTRY_SIZE, [&]
+			{
+				for (const auto& entry : *small_entries)
+				{
+					backend.inflate_raw(entry.deflated, [](const std::uint8_t*, std::size_t)
+					{
+						return true;
+					}, nullptr);
+				}
+			});
+
+			// Back from MB/s to the time a single entry takes
+			const auto microseconds = static_cast<double>(SMALL_ENTRY_SIZE) / (speed * 1024.0 * 1024.0) * 1e6;
+			console::info("%s%s: %.1f us per entry", backend.name, &backend == &utils::inflate::get_backend() ? " (selected)" : "", microseconds);
+		}
+
+		return EXIT_SUCCESS;
+	}
+}
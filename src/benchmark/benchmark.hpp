@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+namespace benchmark
+{
+	// Compares the CRC32 implementation picked for this CPU with zlib's
+	int crc32();
+
+	// Checks the SHA-256 implementation picked for this CPU and reports its throughput
+	int sha256();
+
+	// Inflates every entry of a release archive with each inflate backend, on a single thread.
+	// Then many small generated entries, where the cost of each call shows
+	int inflate(const std::string& archive);
+}
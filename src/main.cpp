@@ -2,24 +2,51 @@
 
 #include "console.hpp"
 
+#include "benchmark/benchmark.hpp"
 #include "updater/updater.hpp"
 
 namespace
 {
 	int unsafe_main(std::string&& prog, std::vector<std::string>&& args)
 	{
-		// Parse command-line flags (only increment i for matching flags)
-		for (auto i = args.begin(); i != args.end();)
+		auto update_iw4x = false;
+
+		// Parse command-line flags, options that take a value consume the next argument
+		for (auto i = args.begin(); i != args.end(); ++i)
 		{
 			if (*i == "-update-iw4x")
 			{
-				return updater::update_iw4x();
+				update_iw4x = true;
+			}
+			else if (*i == "-speculative")
+			{
+				updater::set_speculative_download(true);
+			}
+			else if (*i == "-rate-limit" && std::next(i) != args.end())
+			{
+				++i;
+				updater::set_rate_limit(std::strtoull(i->c_str(), nullptr, 10));
+			}
+			// Not listed in the usage, meant for checking new hosts
+			else if (*i == "-benchmark-crc32")
+			{
+				return benchmark::crc32();
+			}
+			else if (*i == "-benchmark-sha256")
+			{
+				return benchmark::sha256();
+			}
+			else if (*i == "-benchmark-inflate" && std::next(i) != args.end())
+			{
+				return benchmark::inflate(*++i);
 			}
 			else
 			{
 				console::info("AlterWare Installer\n"
 				              "Usage: %s OPTIONS\n"
-				              "  -update-iw4x",
+				              "  -update-iw4x\n"
+				              "  -speculative\n"
+				              "  -rate-limit <KiB/s>",
 				              prog.c_str()
 				);
 
@@ -27,6 +54,11 @@ namespace
 			}
 		}
 
+		if (update_iw4x)
+		{
+			return updater::update_iw4x();
+		}
+
 		return EXIT_SUCCESS;
 	}
 }
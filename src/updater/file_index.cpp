@@ -0,0 +1,194 @@
+#include <std_include.hpp>
+
+#include <console.hpp>
+
+#include "file_index.hpp"
+
+#include <utils/crc32.hpp>
+#include <utils/io.hpp>
+#include <utils/mapped_file.hpp>
+
+namespace updater
+{
+	namespace
+	{
+		// Bump this when the layout of the index changes
+		constexpr std::uint64_t INDEX_VERSION = 1;
+	}
+
+	file_index::file_index(std::filesystem::path index_file, std::filesystem::path base)
+		: index_file_(std::move(index_file))
+		, base_(std::move(base))
+	{
+	}
+
+	void file_index::load()
+	{
+		{
+			std::lock_guard _(this->mutex_);
+			this->entries_.clear();
+		}
+
+		std::string data{};
+		if (!utils::io::read_file(this->index_file_.string(), &data))
+		{
+			return;
+		}
+
+		rapidjson::Document doc{};
+		const rapidjson::ParseResult result = doc.Parse(data);
+		if (!result || !doc.IsObject())
+		{
+			console::warn("Could not parse \"%s\", it will be rebuilt", this->index_file_.string().c_str());
+			return;
+		}
+
+		if (!doc.HasMember("version") || !doc["version"].IsUint64() || doc["version"].GetUint64() != INDEX_VERSION ||
+			!doc.HasMember("base") || !doc["base"].IsString() || !doc.HasMember("files") || !doc["files"].IsObject())
+		{
+			return;
+		}
+
+		// An index of another installation is worthless
+		if (doc["base"].GetString() != this->base_.generic_string())
+		{
+			return;
+		}
+
+		std::lock_guard _(this->mutex_);
+
+		// GetObject collides with a Windows macro
+		const auto& files = doc["files"];
+		for (auto file = files.MemberBegin(); file != files.MemberEnd(); ++file)
+		{
+			const auto& value = file->value;
+			if (!value.IsArray() || value.Size() != 3 || !value[0u].IsUint64() || !value[1u].IsInt64() || !value[2u].IsUint())
+			{
+				continue;
+			}
+
+			this->entries_[file->name.GetString()] = {value[0u].GetUint64(), value[1u].GetInt64(), value[2u].GetUint()};
+		}
+	}
+
+	bool file_index::save() const
+	{
+		rapidjson::Document doc{};
+		doc.SetObject();
+
+		auto& allocator = doc.GetAllocator();
+
+		rapidjson::Value base{};
+		base.SetString(this->base_.generic_string(), allocator);
+
+		std::unique_lock lock(this->mutex_);
+
+		rapidjson::Value files(rapidjson::kObjectType);
+		for (const auto& [file, entry] : this->entries_)
+		{
+			rapidjson::Value value(rapidjson::kArrayType);
+			value.PushBack(entry.size, allocator);
+			value.PushBack(entry.mtime, allocator);
+			value.PushBack(entry.crc, allocator);
+
+			rapidjson::Value key{};
+			key.SetString(file, allocator);
+
+			files.AddMember(key, value, allocator);
+		}
+
+		lock.unlock();
+
+		doc.AddMember("version", INDEX_VERSION, allocator);
+		doc.AddMember("base", base, allocator);
+		doc.AddMember("files", files, allocator);
+
+		rapidjson::StringBuffer buffer{};
+		rapidjson::Writer<rapidjson::StringBuffer, rapidjson::Document::EncodingType, rapidjson::ASCII<>>
+			writer(buffer);
+		doc.Accept(writer);
+
+		return utils::io::write_file(this->index_file_.string(), std::string(buffer.GetString(), buffer.GetLength()));
+	}
+
+	bool file_index::matches(const std::string& file, const std::uint64_t size, const std::uint32_t crc)
+	{
+		const auto current = this->stat(file);
+		if (!current.has_value())
+		{
+			this->remove(file);
+			return false;
+		}
+
+		if (current->size != size)
+		{
+			return false;
+		}
+
+		{
+			std::lock_guard _(this->mutex_);
+			if (const auto entry = this->entries_.find(file);
+				entry != this->entries_.end() && entry->second.size == current->size && entry->second.mtime == current->mtime)
+			{
+				return entry->second.crc == crc;
+			}
+		}
+
+		// Reading the file does not touch the index, other lookups can go on meanwhile
+
+		auto file_crc = 0u;
+		if (size)
+		{
+			const utils::io::mapped_file mapped_file(this->base_ / file);
+			if (!mapped_file.is_open())
+			{
+				return false;
+			}
+
+			file_crc = utils::crc32::compute(mapped_file.data());
+		}
+
+		std::lock_guard _(this->mutex_);
+		this->entries_[file] = {current->size, current->mtime, file_crc};
+		return file_crc == crc;
+	}
+
+	void file_index::update(const std::string& file, const std::uint32_t crc)
+	{
+		const auto current = this->stat(file);
+		if (!current.has_value())
+		{
+			this->remove(file);
+			return;
+		}
+
+		std::lock_guard _(this->mutex_);
+		this->entries_[file] = {current->size, current->mtime, crc};
+	}
+
+	void file_index::remove(const std::string& file)
+	{
+		std::lock_guard _(this->mutex_);
+		this->entries_.erase(file);
+	}
+
+	std::optional<file_index::entry> file_index::stat(const std::string& file) const
+	{
+		const auto path = this->base_ / file;
+
+		std::error_code ec;
+		const auto size = std::filesystem::file_size(path, ec);
+		if (ec)
+		{
+			return {};
+		}
+
+		const auto mtime = std::filesystem::last_write_time(path, ec);
+		if (ec)
+		{
+			return {};
+		}
+
+		return {{size, static_cast<std::int64_t>(mtime.time_since_epoch().count()), 0}};
+	}
+}
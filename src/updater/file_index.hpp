@@ -0,0 +1,39 @@
+#pragma once
+
+namespace updater
+{
+	// Remembers size, modification time and CRC32 of every file the updater deployed.
+	// As long as size and modification time still match, the CRC is trusted without reading the file.
+	// Safe to use from several threads, files are read without holding the lock
+	class file_index
+	{
+	public:
+		file_index(std::filesystem::path index_file, std::filesystem::path base);
+
+		void load();
+		[[nodiscard]] bool save() const;
+
+		// Whether the installed file has the given size and CRC32. Files that changed since they were
+		// indexed are read once and indexed again
+		[[nodiscard]] bool matches(const std::string& file, std::uint64_t size, std::uint32_t crc);
+
+		// Records a file that was just deployed
+		void update(const std::string& file, std::uint32_t crc);
+		void remove(const std::string& file);
+
+	private:
+		struct entry
+		{
+			std::uint64_t size;
+			std::int64_t mtime;
+			std::uint32_t crc;
+		};
+
+		std::filesystem::path index_file_;
+		std::filesystem::path base_;
+		mutable std::mutex mutex_;
+		std::unordered_map<std::string, entry> entries_;
+
+		[[nodiscard]] std::optional<entry> stat(const std::string& file) const;
+	};
+}
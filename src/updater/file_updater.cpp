@@ -5,25 +5,191 @@
 #include "file_updater.hpp"
 
 #include <utils/compression.hpp>
+#include <utils/file_copy.hpp>
 #include <utils/http.hpp>
 #include <utils/io.hpp>
+#include <utils/mapped_file.hpp>
+#include <utils/properties.hpp>
+#include <utils/string.hpp>
 
 namespace updater
 {
 	namespace
 	{
-		std::optional<std::string> get_release_tag(const std::string& release_url)
+		// Neighbouring entries of a delta update are fetched together up to this size
+		constexpr std::uint64_t MAX_DELTA_REQUEST_SIZE = 16 * 1024 * 1024;
+
+		// Bounds the memory used by delta requests that are running or waiting to be extracted
+		constexpr std::uint64_t MAX_DELTA_IN_FLIGHT = 64 * 1024 * 1024;
+
+		// Most installed files are already indexed and only need a stat, a few per thread are not worth a thread
+		constexpr std::size_t MIN_FILES_PER_THREAD = 4;
+
+		// Remembers the validators of every release we looked up. Most runs find no new release,
+		// and then GitHub only answers with 304 which does not count against the rate limit
+		struct cached_release
+		{
+			std::string etag;
+			std::string last_modified;
+			std::string tag_name;
+
+			// SHA-256 of the downloaded asset as published by GitHub, empty for releases that predate digests
+			std::string digest;
+		};
+
+		std::string get_release_cache_file()
+		{
+			const std::filesystem::path properties_file = utils::properties::get_properties_file();
+			return (properties_file.parent_path() / "release-cache.json").string();
+		}
+
+		rapidjson::Document load_release_cache()
+		{
+			rapidjson::Document default_doc{};
+			default_doc.SetObject();
+
+			std::string data{};
+			if (!utils::io::read_file(get_release_cache_file(), &data))
+			{
+				return default_doc;
+			}
+
+			rapidjson::Document doc{};
+			const rapidjson::ParseResult result = doc.Parse(data);
+			if (!result || !doc.IsObject())
+			{
+				return default_doc;
+			}
+
+			return doc;
+		}
+
+		std::optional<cached_release> get_cached_release(const std::string& release_url)
+		{
+			const auto doc = load_release_cache();
+			if (!doc.HasMember(release_url) || !doc[release_url].IsObject())
+			{
+				return {};
+			}
+
+			const auto& entry = doc[release_url];
+			if (!entry.HasMember("etag") || !entry["etag"].IsString() ||
+				!entry.HasMember("last_modified") || !entry["last_modified"].IsString() ||
+				!entry.HasMember("tag_name") || !entry["tag_name"].IsString())
+			{
+				return {};
+			}
+
+			cached_release release{};
+			release.etag = entry["etag"].GetString();
+			release.last_modified = entry["last_modified"].GetString();
+			release.tag_name = entry["tag_name"].GetString();
+
+			if (entry.HasMember("digest") && entry["digest"].IsString())
+			{
+				release.digest = entry["digest"].GetString();
+			}
+
+			return {std::move(release)};
+		}
+
+		void store_cached_release(const std::string& release_url, const cached_release& release)
+		{
+			auto doc = load_release_cache();
+			auto& allocator = doc.GetAllocator();
+
+			while (doc.HasMember(release_url))
+			{
+				doc.RemoveMember(release_url);
+			}
+
+			rapidjson::Value etag{};
+			etag.SetString(release.etag, allocator);
+
+			rapidjson::Value last_modified{};
+			last_modified.SetString(release.last_modified, allocator);
+
+			rapidjson::Value tag_name{};
+			tag_name.SetString(release.tag_name, allocator);
+
+			rapidjson::Value digest{};
+			digest.SetString(release.digest, allocator);
+
+			rapidjson::Value entry{};
+			entry.SetObject();
+			entry.AddMember("etag", etag, allocator);
+			entry.AddMember("last_modified", last_modified, allocator);
+			entry.AddMember("tag_name", tag_name, allocator);
+			entry.AddMember("digest", digest, allocator);
+
+			rapidjson::Value key{};
+			key.SetString(release_url, allocator);
+
+			doc.AddMember(key, entry, allocator);
+
+			rapidjson::StringBuffer buffer{};
+			rapidjson::Writer<rapidjson::StringBuffer, rapidjson::Document::EncodingType, rapidjson::ASCII<>>
+				writer(buffer);
+			doc.Accept(writer);
+
+			utils::io::write_file(get_release_cache_file(), std::string(buffer.GetString(), buffer.GetLength()));
+		}
+
+		// GitHub lists the digest of every asset as "sha256:<hex>"
+		std::string get_asset_digest(const rapidjson::Document& release_json, const std::string& asset_name)
 		{
-			const auto release_info = utils::http::get_data(release_url);
+			if (!release_json.HasMember("assets") || !release_json["assets"].IsArray())
+			{
+				return {};
+			}
+
+			for (const auto& asset : release_json["assets"].GetArray())
+			{
+				if (!asset.IsObject() || !asset.HasMember("name") || !asset["name"].IsString() || asset["name"].GetString() != asset_name)
+				{
+					continue;
+				}
+
+				if (!asset.HasMember("digest") || !asset["digest"].IsString())
+				{
+					return {};
+				}
+
+				constexpr std::string_view prefix = "sha256:";
+				const std::string_view digest = asset["digest"].GetString();
+				if (!digest.starts_with(prefix))
+				{
+					return {};
+				}
+
+				return utils::string::to_lower(std::string(digest.substr(prefix.size())));
+			}
+
+			return {};
+		}
+
+		std::optional<cached_release> get_release(const std::string& release_url, const std::string& asset_name)
+		{
+			const auto cached = get_cached_release(release_url);
+			const auto etag = cached.has_value() ? cached->etag : std::string{};
+			const auto last_modified = cached.has_value() ? cached->last_modified : std::string{};
+
+			const auto release_info = utils::http::get_data_conditional(release_url, etag, last_modified);
 			if (!release_info.has_value())
 			{
 				console::warn("Could not reach remote URL \"%s\"", release_url.c_str());
 				return {};
 			}
 
+			if (release_info->status == 304 && cached.has_value())
+			{
+				console::log("Release info from \"%s\" did not change since the last check", release_url.c_str());
+				return cached;
+			}
+
 			rapidjson::Document release_json{};
 
-			const rapidjson::ParseResult result = release_json.Parse(release_info.value());
+			const rapidjson::ParseResult result = release_json.Parse(release_info->data);
 			if (!result || !release_json.IsObject())
 			{
 				console::error("Could not parse remote JSON response from \"%s\"", release_url.c_str());
@@ -36,8 +202,111 @@ namespace updater
 				return {};
 			}
 
-			const auto* tag_name = release_json["tag_name"].GetString();
-			return tag_name;
+			cached_release release{};
+			release.etag = release_info->etag;
+			release.last_modified = release_info->last_modified;
+			release.tag_name = release_json["tag_name"].GetString();
+			release.digest = get_asset_digest(release_json, asset_name);
+
+			if (!release.etag.empty() || !release.last_modified.empty())
+			{
+				store_cached_release(release_url, release);
+			}
+
+			return {std::move(release)};
+		}
+
+		// A "<hash>  <file name>" sidecar as written by sha256sum
+		std::string get_sidecar_digest(const std::string& download_url)
+		{
+			const auto data = utils::http::get_data(download_url + ".sha256");
+			if (!data.has_value())
+			{
+				return {};
+			}
+
+			const auto end = data->find_first_of(" \t\r\n");
+			auto digest = utils::string::to_lower(data->substr(0, end));
+			if (digest.size() != 64 || digest.find_first_not_of("0123456789abcdef") != std::string::npos)
+			{
+				return {};
+			}
+
+			return digest;
+		}
+
+		// Fetches [begin, end) of the remote archive. The request fails if the archive changed since info was taken
+		std::future<std::optional<std::string>> fetch_range(const utils::http::file_info& info, const std::uint64_t begin, const std::uint64_t end)
+		{
+			auto promise = std::make_shared<std::promise<std::optional<std::string>>>();
+			auto result = promise->get_future();
+
+			utils::http::request_options options{};
+			options.range = std::to_string(begin) + "-" + std::to_string(end - 1);
+
+			// A changed archive is sent as a whole, don't wait for all of it
+			options.max_size = static_cast<std::size_t>(end - begin);
+			if (!info.etag.empty())
+			{
+				options.headers["If-Range"] = info.etag;
+			}
+			else if (!info.last_modified.empty())
+			{
+				options.headers["If-Range"] = info.last_modified;
+			}
+
+			const auto expected_size = end - begin;
+			utils::http::get_data_async(info.effective_url, [promise, expected_size](std::optional<std::string>&& data)
+			{
+				if (data.has_value() && data->size() != expected_size)
+				{
+					data.reset();
+				}
+
+				promise->set_value(std::move(data));
+			}, options);
+
+			return result;
+		}
+
+		std::span<const std::byte> as_bytes(const std::string& data)
+		{
+			return {reinterpret_cast<const std::byte*>(data.data()), data.size()};
+		}
+
+		std::optional<std::vector<utils::compression::zip::entry_info>> read_archive_entries(const std::filesystem::path& archive)
+		{
+			const utils::io::mapped_file mapped_file(archive);
+			if (!mapped_file.is_open())
+			{
+				return {};
+			}
+
+			const auto data = mapped_file.data();
+			const auto tail = data.last(std::min(data.size(), utils::compression::zip::MAX_END_OF_CENTRAL_DIRECTORY_SIZE));
+
+			const auto directory = utils::compression::zip::find_central_directory(tail, data.size());
+			if (!directory.has_value())
+			{
+				return {};
+			}
+
+			return utils::compression::zip::read_central_directory(data.subspan(static_cast<std::size_t>(directory->offset), static_cast<std::size_t>(directory->size)));
+		}
+
+		void print_http_timings()
+		{
+			const auto timings = utils::http::get_timings();
+			if (!timings.requests)
+			{
+				return;
+			}
+
+			console::log("HTTP: %zu requests over %zu new connections. DNS %lld ms, connect %lld ms, TLS %lld ms",
+			             timings.requests, timings.connections,
+			             static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(timings.dns).count()),
+			             static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(timings.connect).count()),
+			             static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(timings.tls).count()));
 		}
 	}
 
@@ -55,30 +324,82 @@ namespace updater
 
 	bool file_updater::update_if_necessary() const
 	{
+		const auto _ = gsl::finally(print_http_timings);
+
 		update_state update_state;
 
+		std::atomic_bool cancel_download = false;
+		std::future<bool> download{};
+		download_result result{};
+
+		// Most of the time the download is not needed, but when it is we save a full round trip to GitHub
+		if (this->speculative_download_)
+		{
+			console::info("Downloading %s while checking for updates", this->name_.c_str());
+			download = std::async(std::launch::async, [this, &result, &cancel_download]
+			{
+				return this->update_file(result, &cancel_download);
+			});
+		}
+
+		// Never wait for a download nobody is interested in anymore
+		const auto cancel_on_exit = gsl::finally([&cancel_download]
+		{
+			cancel_download = true;
+		});
+
 		const auto local_version = this->read_local_revision_file();
 		if (!this->does_require_update(update_state, local_version))
 		{
+			if (download.valid())
+			{
+				cancel_download = true;
+				download.wait();
+				this->discard_download();
+			}
+
 			console::log("%s does not require an update", this->name_.c_str());
 			return true;
 		}
 
 		console::info("Updating %s", this->name_.c_str());
-		if (!this->update_file(this->remote_download_))
+
+		file_index index(this->get_index_file(), this->base_);
+		index.load();
+
+		file_crcs archive_files{};
+		const auto delta = !download.valid() && this->delta_updates_ && this->update_delta(index, archive_files);
+		if (!delta)
 		{
-			console::error("Update failed");
-			return false;
-		}
+			const auto downloaded = download.valid() ? download.get() : this->update_file(result);
+			if (!downloaded)
+			{
+				console::error("Update failed");
+				return false;
+			}
 
-		this->cleanup_directories();
+			if (!this->verify_download(update_state.digest, result.sha256))
+			{
+				this->discard_download();
+				console::error("Update failed");
+				return false;
+			}
+		}
 
-		if (!this->deploy_files())
+		if (!this->deploy_files(result.extracted || delta, archive_files, index))
 		{
 			console::error("Unable to deploy files");
 			return false;
 		}
 
+		// Only once the new files are in place, the directories are never missing anything in between
+		this->remove_stale_files(archive_files, index);
+
+		if (!index.save())
+		{
+			console::warn("Could not write \"%s\"", this->get_index_file().string().c_str());
+		}
+
 		// Do this last to make sure we don't ever create a version file when something failed
 		this->create_version_file(update_state.latest_tag);
 
@@ -95,6 +416,60 @@ namespace updater
 		this->skip_files_.emplace_back(file);
 	}
 
+	void file_updater::add_file_to_include(const std::string& file)
+	{
+		this->include_files_.emplace_back(file);
+	}
+
+	void file_updater::set_download_connections(const std::size_t connections)
+	{
+		this->download_connections_ = std::max<std::size_t>(connections, 1);
+	}
+
+	void file_updater::add_mirror(const std::string& url)
+	{
+		this->mirrors_.emplace_back(url);
+	}
+
+	void file_updater::set_speculative_download(const bool enabled)
+	{
+		this->speculative_download_ = enabled;
+	}
+
+	void file_updater::set_stream_extraction(const bool enabled)
+	{
+		this->stream_extraction_ = enabled;
+	}
+
+	void file_updater::set_delta_updates(const bool enabled)
+	{
+		this->delta_updates_ = enabled;
+	}
+
+	std::filesystem::path file_updater::get_index_file() const
+	{
+		// Lives next to the version file
+		auto index_file = this->version_file_;
+		index_file.replace_filename(this->version_file_.stem().string() + "-index.json");
+		return index_file;
+	}
+
+	std::filesystem::path file_updater::get_staging_directory() const
+	{
+		// Hidden and on the same filesystem as the installed files, so deploying only renames them
+		return this->base_ / ("." + this->out_name_.stem().string() + "-staging");
+	}
+
+	std::filesystem::path file_updater::get_download_file() const
+	{
+		return this->get_staging_directory() / this->out_name_;
+	}
+
+	std::filesystem::path file_updater::get_extract_directory() const
+	{
+		return this->get_staging_directory() / "out";
+	}
+
 	std::string file_updater::read_local_revision_file() const
 	{
 		const std::filesystem::path revision_file_path = this->version_file_;
@@ -127,8 +502,8 @@ namespace updater
 	{
 		console::info("Fetching tags from GitHub");
 
-		const auto raw_files_tag = get_release_tag(this->remote_tag_);
-		if (!raw_files_tag.has_value())
+		const auto release = get_release(this->remote_tag_, this->out_name_.string());
+		if (!release.has_value())
 		{
 			console::warn("Failed to reach GitHub. Aborting the update");
 
@@ -136,10 +511,11 @@ namespace updater
 			return update_state.requires_update;
 		}
 
-		update_state.requires_update = local_version != raw_files_tag.value();
-		update_state.latest_tag = raw_files_tag.value();
+		update_state.requires_update = local_version != release->tag_name;
+		update_state.latest_tag = release->tag_name;
+		update_state.digest = release->digest;
 
-		console::info("Got release tag \"%s\". Requires updating: %s", raw_files_tag->c_str(), update_state.requires_update ? "Yes" : "No");
+		console::info("Got release tag \"%s\". Requires updating: %s", release->tag_name.c_str(), update_state.requires_update ? "Yes" : "No");
 		return update_state.requires_update;
 	}
 
@@ -167,36 +543,65 @@ namespace updater
 		console::error("Error while writing file \"%s\"", this->version_file_.string().c_str());
 	}
 
-	bool file_updater::update_file(const std::string& url) const
+	bool file_updater::update_file(download_result& result, const std::atomic_bool* cancel) const
 	{
-		console::info("Downloading %s", url.c_str());
-		const auto data = utils::http::get_data(url, {});
-		if (!data.has_value())
+		result = {};
+
+		// Download the files in the staging directory, move them later.
+		const auto out_file = this->get_download_file();
+		const auto out_dir = this->get_extract_directory();
+		utils::io::create_directory(this->get_staging_directory());
+
+		std::vector<std::string> sources{this->remote_download_};
+		sources.insert(sources.end(), this->mirrors_.begin(), this->mirrors_.end());
+
+		if (sources.size() > 1)
 		{
-			console::error("Failed to download %s", url.c_str());
-			return false;
+			console::info("Probing %zu download sources", sources.size());
+			sources = utils::http::rank_sources(sources);
 		}
 
-		if (data->empty())
+		utils::http::download_options options{};
+		options.connections = this->download_connections_;
+		options.cancel = cancel;
+		options.sha256 = &result.sha256;
+
+		// The archive still ends up on disk, if streaming does not work out it is extracted from there
+		std::unique_ptr<utils::compression::zip::stream_extractor> extractor{};
+		if (this->stream_extraction_)
 		{
-			console::error("The data buffer returned by cURL is empty");
-			return false;
+			std::error_code ec;
+			std::filesystem::remove_all(out_dir, ec);
+			extractor = std::make_unique<utils::compression::zip::stream_extractor>(out_dir, this->get_entry_filter());
+			options.on_data = [&extractor](const char* data, const std::size_t size)
+			{
+				extractor->feed(data, size);
+			};
 		}
 
-		// Download the files in the temp directory, move them later.
-		std::error_code ec;
-		const auto out_file = std::filesystem::temp_directory_path(ec) / this->out_name_;
-		if (ec)
+		console::info("Downloading %s to \"%s\"", sources.front().c_str(), out_file.string().c_str());
+		if (!utils::http::download_file_segmented(sources, out_file, options))
 		{
-			console::error("Got error \"%s\" while trying to get the temp dir", ec.message().c_str());
+			console::error("Failed to download %s", sources.front().c_str());
 			return false;
 		}
 
-		console::info("Writing file to \"%s\"", out_file.string().c_str());
+		if (extractor)
+		{
+			result.extracted = extractor->finish();
+			if (result.extracted)
+			{
+				console::info("Extracted %zu entries while downloading", extractor->get_entry_count());
+			}
+			else
+			{
+				console::warn("Could not extract \"%s\" while downloading: %s", out_file.string().c_str(), extractor->get_error().c_str());
+			}
+		}
 
-		if (!utils::io::write_file(out_file.string(), data.value(), false))
+		if (!utils::io::file_size(out_file.string()))
 		{
-			console::error("Error while writing file \"%s\"", out_file.string().c_str());
+			console::error("The file downloaded by cURL is empty");
 			return false;
 		}
 
@@ -204,77 +609,439 @@ namespace updater
 		return true;
 	}
 
-	// Not a fan of using exceptions here. Once C++23 is more widespread I'd like to use <expected>
-	bool file_updater::deploy_files() const
+	bool file_updater::update_delta(file_index& index, file_crcs& archive_files) const
 	{
-		std::error_code ec;
-		const auto out_dir = std::filesystem::temp_directory_path(ec) / ".out";
-		if (ec)
+		const auto out_dir = this->get_extract_directory();
+
+		const auto info = utils::http::get_file_info(this->remote_download_);
+		if (!info.has_value() || !info->accepts_ranges || !info->size)
 		{
-			console::error("Got error \"%s\" while trying to get the temp dir", ec.message().c_str());
+			console::log("%s can't be fetched in parts, downloading all of it", this->remote_download_.c_str());
 			return false;
 		}
 
-		const auto out_file = std::filesystem::temp_directory_path(ec) / this->out_name_;
-		if (ec)
+		const auto tail_size = std::min<std::uint64_t>(info->size, utils::compression::zip::MAX_END_OF_CENTRAL_DIRECTORY_SIZE);
+		const auto tail_offset = info->size - tail_size;
+
+		const auto tail = fetch_range(*info, tail_offset, info->size).get();
+		if (!tail.has_value())
 		{
-			console::error("Got error \"%s\" while trying to get the temp dir", ec.message().c_str());
+			console::warn("Could not fetch the end of %s", this->remote_download_.c_str());
 			return false;
 		}
 
-		assert(utils::io::file_exists(out_file.string()));
+		const auto directory = utils::compression::zip::find_central_directory(as_bytes(*tail), info->size);
+		if (!directory.has_value())
+		{
+			console::warn("Could not locate the central directory of %s", this->remote_download_.c_str());
+			return false;
+		}
 
-		// Always try to clean-up
-		const auto _ = gsl::finally([&out_dir, &out_file, &ec]() -> void
+		std::optional<std::string> directory_data{};
+		if (directory->offset >= tail_offset)
 		{
-			utils::io::remove_file(out_file.string());
+			directory_data = tail->substr(static_cast<std::size_t>(directory->offset - tail_offset), static_cast<std::size_t>(directory->size));
+		}
+		else
+		{
+			directory_data = fetch_range(*info, directory->offset, directory->offset + directory->size).get();
+		}
 
-			std::filesystem::remove_all(out_dir, ec);
-			if (ec)
+		auto entries = directory_data.has_value() ? utils::compression::zip::read_central_directory(as_bytes(*directory_data)) : std::nullopt;
+		if (!entries.has_value() || entries->size() != directory->entries)
+		{
+			console::warn("Could not read the central directory of %s", this->remote_download_.c_str());
+			return false;
+		}
+
+		// Records are stored one after another, each one ends where the next one starts
+		std::sort(entries->begin(), entries->end(), [](const auto& a, const auto& b)
+		{
+			return a.local_header_offset < b.local_header_offset;
+		});
+
+		struct request
+		{
+			std::uint64_t begin;
+			std::uint64_t end;
+			std::vector<std::size_t> entries;
+		};
+
+		std::vector<std::size_t> candidates{};
+		std::size_t file_count = 0;
+
+		for (std::size_t i = 0; i < entries->size(); ++i)
+		{
+			const auto& entry = (*entries)[i];
+			if (utils::compression::zip::is_directory(entry))
 			{
-				console::error("Got error \"%s\" while trying to clean-up the temp dir", ec.message().c_str());
+				continue;
 			}
-		});
 
-		try
+			++file_count;
+			archive_files.emplace(entry.name, entry.crc);
+
+			if (this->is_wanted(entry.name))
+			{
+				candidates.emplace_back(i);
+			}
+		}
+
+		// Without an index every installed file is read, spread that across threads like deploying does.
+		// Not a vector<bool>, its elements can't be written from several threads
+		std::vector<std::uint8_t> changed(entries->size());
+		std::atomic_size_t next_candidate = 0;
+
+		const auto worker = [&]
+		{
+			while (true)
+			{
+				const auto candidate = next_candidate++;
+				if (candidate >= candidates.size())
+				{
+					break;
+				}
+
+				const auto i = candidates[candidate];
+				const auto& entry = (*entries)[i];
+				changed[i] = !index.matches(entry.name, entry.uncompressed_size, entry.crc);
+			}
+		};
+
+		const auto thread_count = std::clamp<std::size_t>(candidates.size() / MIN_FILES_PER_THREAD, 1, std::max(std::thread::hardware_concurrency(), 1u));
+
+		std::vector<std::thread> threads{};
+		threads.reserve(thread_count - 1);
+
+		for (std::size_t i = 1; i < thread_count; ++i)
+		{
+			threads.emplace_back(worker);
+		}
+
+		worker();
+
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+
+		std::vector<request> requests{};
+		std::uint64_t changed_bytes = 0;
+		std::size_t changed_files = 0;
+
+		for (std::size_t i = 0; i < entries->size(); ++i)
+		{
+			if (!changed[i])
+			{
+				continue;
+			}
+
+			const auto& entry = (*entries)[i];
+			const auto begin = entry.local_header_offset;
+			const auto end = i + 1 < entries->size() ? (*entries)[i + 1].local_header_offset : directory->offset;
+			if (end <= begin)
+			{
+				console::warn("Entry \"%s\" of %s is not where it should be", entry.name.c_str(), this->remote_download_.c_str());
+				return false;
+			}
+
+			++changed_files;
+			changed_bytes += end - begin;
+
+			if (!requests.empty() && requests.back().end == begin && end - requests.back().begin <= MAX_DELTA_REQUEST_SIZE)
+			{
+				requests.back().end = end;
+				requests.back().entries.emplace_back(i);
+			}
+			else
+			{
+				requests.push_back({begin, end, {i}});
+			}
+		}
+
+		// One stream is cheaper than many ranges once most of the archive is needed anyway
+		if (changed_bytes > info->size / 2)
+		{
+			console::info("%zu of %zu files changed, downloading the whole archive", changed_files, file_count);
+			return false;
+		}
+
+		console::info("%zu of %zu files changed, fetching %llu of %llu bytes", changed_files, file_count,
+		              static_cast<unsigned long long>(changed_bytes), static_cast<unsigned long long>(info->size));
+
+		std::error_code ec;
+		std::filesystem::remove_all(out_dir, ec);
+		utils::io::create_directory(out_dir);
+
+		std::deque<std::pair<const request*, std::future<std::optional<std::string>>>> running{};
+		std::uint64_t in_flight = 0;
+		std::size_t next = 0;
+
+		while (next < requests.size() || !running.empty())
+		{
+			while (next < requests.size() && (running.empty() || in_flight + requests[next].end - requests[next].begin <= MAX_DELTA_IN_FLIGHT))
+			{
+				const auto& request = requests[next++];
+				running.emplace_back(&request, fetch_range(*info, request.begin, request.end));
+				in_flight += request.end - request.begin;
+			}
+
+			const auto* request = running.front().first;
+			const auto data = running.front().second.get();
+			running.pop_front();
+			in_flight -= request->end - request->begin;
+
+			if (!data.has_value())
+			{
+				console::warn("Could not fetch bytes %llu-%llu of %s", static_cast<unsigned long long>(request->begin),
+				              static_cast<unsigned long long>(request->end - 1), this->remote_download_.c_str());
+				return false;
+			}
+
+			for (const auto index : request->entries)
+			{
+				const auto& entry = (*entries)[index];
+				const auto end = index + 1 < entries->size() ? (*entries)[index + 1].local_header_offset : directory->offset;
+				const auto record = as_bytes(*data).subspan(static_cast<std::size_t>(entry.local_header_offset - request->begin),
+				                                            static_cast<std::size_t>(end - entry.local_header_offset));
+
+				std::string error{};
+				if (!utils::compression::zip::extract_entry(entry, record, out_dir, &error))
+				{
+					console::warn("Could not extract \"%s\": %s", entry.name.c_str(), error.c_str());
+					return false;
+				}
+			}
+		}
+
+		console::info("Done fetching the changed files of %s", this->remote_download_.c_str());
+		return true;
+	}
+
+	bool file_updater::verify_download(std::string expected, const std::string& actual) const
+	{
+		if (expected.empty())
+		{
+			expected = get_sidecar_digest(this->remote_download_);
+		}
+
+		if (expected.empty())
 		{
-			utils::io::create_directory(out_dir);
-			utils::compression::zip::archive::decompress(out_file.string(), out_dir);
+			console::warn("No SHA-256 is published for %s, it can't be verified", this->remote_download_.c_str());
+			return true;
 		}
-		catch (const std::exception& ex)
+
+		if (actual != expected)
 		{
-			console::error("Got error \"%s\" while decompressing \"%s\"", ex.what(), out_file.string().c_str());
+			console::error("SHA-256 of %s does not match the published one. Expected %s, got %s",
+			               this->remote_download_.c_str(), expected.c_str(), actual.empty() ? "nothing" : actual.c_str());
 			return false;
 		}
 
-		console::info("\"%s\" was decompressed. Removing files that must be skipped", out_file.string().c_str());
-		this->skip_files(out_dir);
+		console::info("Verified the SHA-256 of %s", this->remote_download_.c_str());
+		return true;
+	}
+
+	void file_updater::discard_download() const
+	{
+		std::error_code ec;
+		std::filesystem::remove_all(this->get_staging_directory(), ec);
+	}
+
+	// Not a fan of using exceptions here. Once C++23 is more widespread I'd like to use <expected>
+	bool file_updater::deploy_files(const bool extracted, file_crcs& archive_files, file_index& index) const
+	{
+		std::error_code ec;
+		const auto staging_dir = this->get_staging_directory();
+		const auto out_dir = this->get_extract_directory();
+		const auto out_file = this->get_download_file();
+
+		// Delta updates never download the archive itself
+		assert(extracted || utils::io::file_exists(out_file.string()));
+
+		// Always try to clean-up
+		const auto _ = gsl::finally([&staging_dir, &ec]() -> void
+		{
+			std::filesystem::remove_all(staging_dir, ec);
+			if (ec)
+			{
+				console::error("Got error \"%s\" while trying to clean-up the staging dir", ec.message().c_str());
+			}
+		});
+
+		if (!extracted)
+		{
+			try
+			{
+				// Leftovers of a failed streaming extraction
+				std::filesystem::remove_all(out_dir, ec);
+
+				utils::io::create_directory(out_dir);
+				utils::compression::zip::archive::decompress(out_file.string(), out_dir, this->get_entry_filter());
+			}
+			catch (const std::exception& ex)
+			{
+				console::error("Got error \"%s\" while decompressing \"%s\"", ex.what(), out_file.string().c_str());
+				return false;
+			}
+
+			console::info("\"%s\" was decompressed", out_file.string().c_str());
+		}
 
 		console::info("Deploying files to \"%s\"", this->base_.string().c_str());
 
-		utils::io::copy_folder(out_dir, this->base_);
+		if (archive_files.empty())
+		{
+			for (auto& entry : read_archive_entries(out_file).value_or(std::vector<utils::compression::zip::entry_info>{}))
+			{
+				archive_files.emplace(std::move(entry.name), entry.crc);
+			}
+		}
+
+		// Installed files the index already knows to be identical stay where they are
+		utils::io::copy_options options{};
+		options.move = true;
+		options.is_unchanged = [&](const std::filesystem::path& path, const std::filesystem::path& src, const std::filesystem::path&)
+		{
+			const auto entry = archive_files.find(path.generic_string());
+			std::error_code size_ec;
+			const auto size = std::filesystem::file_size(src, size_ec);
+			if (entry == archive_files.end() || size_ec)
+			{
+				return false;
+			}
+
+			return index.matches(entry->first, size, entry->second);
+		};
+
+		const auto result = utils::io::copy_folder(out_dir, this->base_, options);
+		for (const auto& [path, error] : result.errors)
+		{
+			console::error("Could not deploy \"%s\": %s", path.string().c_str(), error.message().c_str());
+		}
+
+		for (const auto& path : result.copied)
+		{
+			const auto file = path.generic_string();
+			if (const auto entry = archive_files.find(file); entry != archive_files.end())
+			{
+				index.update(file, entry->second);
+			}
+			else
+			{
+				index.remove(file);
+			}
+		}
+
+		console::info("Deployed %zu files, %zu were already up to date", result.copied.size(), result.unchanged.size());
+
+		if (!result.errors.empty())
+		{
+			return false;
+		}
+
 		return true;
 	}
 
-	void file_updater::cleanup_directories() const
+	void file_updater::remove_stale_files(const file_crcs& archive_files, file_index& index) const
 	{
-		console::log("Cleaning up directories");
-		std::for_each(this->cleanup_directories_.begin(), this->cleanup_directories_.end(), [](const auto& dir)
+		// Without the list of archive entries every installed file would look stale
+		if (archive_files.empty())
 		{
+			console::warn("The files of the release are unknown, not removing anything");
+			return;
+		}
+
+#ifdef _WIN32
+		// The case of a path in the archive doesn't have to match the directories on disk
+		std::unordered_set<std::string> release_files{};
+		for (const auto& file : archive_files | std::views::keys)
+		{
+			release_files.emplace(utils::string::to_lower(file));
+		}
+
+		const auto is_stale = [&release_files](const std::string& file)
+		{
+			return !release_files.contains(utils::string::to_lower(file));
+		};
+#else
+		const auto is_stale = [&archive_files](const std::string& file)
+		{
+			return !archive_files.contains(file);
+		};
+#endif
+
+		console::log("Removing files that are not part of the release anymore");
+		for (const auto& dir : this->cleanup_directories_)
+		{
+			std::vector<std::filesystem::path> stale_files{};
+
 			std::error_code ec;
-			std::filesystem::remove_all(dir, ec);
-			console::log("Removed directory \"%s\"", dir.string().c_str());
-		});
+			for (std::filesystem::recursive_directory_iterator i(dir, ec), end; !ec && i != end; i.increment(ec))
+			{
+				std::error_code file_ec;
+				if (!i->is_regular_file(file_ec))
+				{
+					continue;
+				}
+
+				const auto file = std::filesystem::relative(i->path(), this->base_, file_ec).generic_string();
+				if (!file_ec && is_stale(file))
+				{
+					stale_files.emplace_back(i->path());
+				}
+			}
+
+			for (const auto& path : stale_files)
+			{
+				std::error_code file_ec;
+				index.remove(std::filesystem::relative(path, this->base_, file_ec).generic_string());
+
+				if (!utils::io::remove_file(path.string()))
+				{
+					console::warn("Could not remove \"%s\"", path.string().c_str());
+					continue;
+				}
+
+				console::log("Removed file \"%s\"", path.string().c_str());
+
+				// Directories left empty go too, removing one that still holds anything simply fails
+				for (auto parent = path.parent_path(); parent != dir && parent.has_relative_path(); parent = parent.parent_path())
+				{
+					if (!std::filesystem::remove(parent, file_ec))
+					{
+						break;
+					}
+				}
+			}
+		}
 	}
 
-	void file_updater::skip_files(const std::filesystem::path& target_dir) const
+	bool file_updater::is_wanted(const std::string& file) const
 	{
-		console::log("Skipping files");
-		std::for_each(this->skip_files_.begin(), this->skip_files_.end(), [&target_dir](const auto& file)
+		const auto matches = [&file](const std::string& pattern)
 		{
-			const auto target_file = target_dir / file;
-			utils::io::remove_file(target_file.string());
-			console::log("Removed file \"%s\"", target_file.string().c_str());
-		});
+			return utils::string::match_glob(pattern, file);
+		};
+
+		if (std::any_of(this->skip_files_.begin(), this->skip_files_.end(), matches))
+		{
+			return false;
+		}
+
+		return this->include_files_.empty() || std::any_of(this->include_files_.begin(), this->include_files_.end(), matches);
+	}
+
+	utils::compression::zip::entry_filter file_updater::get_entry_filter() const
+	{
+		if (this->skip_files_.empty() && this->include_files_.empty())
+		{
+			return {};
+		}
+
+		return [this](const std::string& name)
+		{
+			return this->is_wanted(name);
+		};
 	}
 }
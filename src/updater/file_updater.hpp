@@ -1,5 +1,9 @@
 #pragma once
 
+#include "file_index.hpp"
+
+#include <utils/compression.hpp>
+
 namespace updater
 {
 	class file_updater
@@ -10,13 +14,44 @@ namespace updater
 		[[nodiscard]] bool update_if_necessary() const;
 
 		void add_dir_to_clean(const std::string& dir);
+		// Archive entries matching any of these globs are never extracted (see utils::string::match_glob)
 		void add_file_to_skip(const std::string& file);
 
+		// Once any are added, only entries matching one of these globs are extracted
+		void add_file_to_include(const std::string& file);
+
+		void set_download_connections(std::size_t connections);
+
+		// Additional URLs that serve the same asset as remote_download
+		void add_mirror(const std::string& url);
+
+		// Starts downloading while the release tag is still being checked
+		void set_speculative_download(bool enabled);
+
+		// Extracts the archive while it is being downloaded
+		void set_stream_extraction(bool enabled);
+
+		// Only fetches the entries that differ from the installed files. Not used together with speculative downloads.
+		// Off by default, the entries are only checked against their CRC32 and not against the published digest
+		void set_delta_updates(bool enabled);
+
 	private:
 		struct update_state
 		{
 			bool requires_update = false;
 			std::string latest_tag;
+
+			// Expected SHA-256 of the release archive, empty if the release JSON does not list one
+			std::string digest;
+		};
+
+		struct download_result
+		{
+			// The archive was extracted to the staging directory while it was downloaded
+			bool extracted = false;
+
+			// Computed while the archive was downloaded
+			std::string sha256;
 		};
 
 		std::string name_;
@@ -27,20 +62,45 @@ namespace updater
 
 		std::string remote_tag_;
 		std::string remote_download_;
+		std::vector<std::string> mirrors_;
+
+		// Number of parallel ranged requests used for the download
+		std::size_t download_connections_ = 4;
 
-		// Directories to cleanup
+		bool speculative_download_ = false;
+		bool stream_extraction_ = true;
+		bool delta_updates_ = false;
+
+		// Files below these directories that are not part of the release are removed after deploying
 		std::vector<std::filesystem::path> cleanup_directories_;
 
 		// Files to skip
 		std::vector<std::string> skip_files_;
 
+		// Files to extract, empty means all of them
+		std::vector<std::string> include_files_;
+
+		[[nodiscard]] std::filesystem::path get_index_file() const;
+
+		// Everything downloaded or extracted is staged next to the installed files until it is deployed
+		[[nodiscard]] std::filesystem::path get_staging_directory() const;
+		[[nodiscard]] std::filesystem::path get_download_file() const;
+		[[nodiscard]] std::filesystem::path get_extract_directory() const;
 		[[nodiscard]] std::string read_local_revision_file() const;
 		[[nodiscard]] bool does_require_update(update_state& update_state, const std::string& local_version) const;
 		void create_version_file(const std::string& revision_version) const;
-		[[nodiscard]] bool update_file(const std::string& url) const;
-		[[nodiscard]] bool deploy_files() const;
+		[[nodiscard]] bool update_file(download_result& result, const std::atomic_bool* cancel = nullptr) const;
+		// Archive entry names mapped to their CRC32
+		using file_crcs = std::unordered_map<std::string, std::uint32_t>;
+
+		[[nodiscard]] bool update_delta(file_index& index, file_crcs& archive_files) const;
+		// Compares the archive with the digest from the release JSON, or a .sha256 sidecar next to the download
+		[[nodiscard]] bool verify_download(std::string expected, const std::string& actual) const;
+		void discard_download() const;
+		[[nodiscard]] bool deploy_files(bool extracted, file_crcs& archive_files, file_index& index) const;
 
-		void cleanup_directories() const;
-		void skip_files(const std::filesystem::path& target_dir) const;
+		void remove_stale_files(const file_crcs& archive_files, file_index& index) const;
+		[[nodiscard]] bool is_wanted(const std::string& file) const;
+		[[nodiscard]] utils::compression::zip::entry_filter get_entry_filter() const;
 	};
 }
@@ -5,7 +5,11 @@
 #include "file_updater.hpp"
 #include "updater.hpp"
 
+#include <utils/compression.hpp>
+#include <utils/http.hpp>
+#include <utils/inflate.hpp>
 #include <utils/properties.hpp>
+#include <utils/string.hpp>
 
 #define IW4X_VERSION_FILE "iw4x-version.json"
 #define IW4X_RAW_FILES_UPDATE_FILE "release.zip"
@@ -14,6 +18,144 @@
 
 namespace updater
 {
+	namespace
+	{
+		constexpr auto RATE_LIMIT_POLL_INTERVAL = 2s;
+
+		std::optional<std::uint64_t> rate_limit_override;
+		std::optional<bool> speculative_download_override;
+
+		bool load_speculative_download()
+		{
+			if (speculative_download_override.has_value())
+			{
+				return speculative_download_override.value();
+			}
+
+			const auto value = utils::properties::load("speculative-download");
+			return value.has_value() && (value.value() == "true" || value.value() == "1");
+		}
+
+		// Comma separated, empty items are dropped
+		std::vector<std::string> load_list(const std::string& property)
+		{
+			std::vector<std::string> items{};
+			if (const auto value = utils::properties::load(property); value.has_value())
+			{
+				for (auto& item : utils::string::split(value.value(), ','))
+				{
+					if (!item.empty())
+					{
+						items.emplace_back(std::move(item));
+					}
+				}
+			}
+
+			return items;
+		}
+
+		std::uint64_t load_rate_limit()
+		{
+			if (rate_limit_override.has_value())
+			{
+				return rate_limit_override.value();
+			}
+
+			const auto value = utils::properties::load("download-rate-limit");
+			if (!value.has_value())
+			{
+				return 0;
+			}
+
+			return std::strtoull(value->c_str(), nullptr, 10);
+		}
+
+		// Applies the rate limit and keeps an eye on the properties file while an update runs,
+		// so the limit can be changed without restarting a long download
+		class rate_limit_watcher
+		{
+		public:
+			rate_limit_watcher()
+			{
+				this->apply(load_rate_limit());
+
+				if (!rate_limit_override.has_value())
+				{
+					this->thread_ = std::thread([this]
+					{
+						this->run();
+					});
+				}
+			}
+
+			~rate_limit_watcher()
+			{
+				{
+					std::lock_guard _(this->mutex_);
+					this->stopping_ = true;
+				}
+
+				this->cv_.notify_all();
+				if (this->thread_.joinable())
+				{
+					this->thread_.join();
+				}
+			}
+
+			rate_limit_watcher(rate_limit_watcher&&) = delete;
+			rate_limit_watcher(const rate_limit_watcher&) = delete;
+			rate_limit_watcher& operator=(rate_limit_watcher&&) = delete;
+			rate_limit_watcher& operator=(const rate_limit_watcher&) = delete;
+
+		private:
+			std::thread thread_;
+			std::mutex mutex_;
+			std::condition_variable cv_;
+			bool stopping_ = false;
+			std::uint64_t current_ = 0;
+
+			void apply(const std::uint64_t kib_per_second)
+			{
+				this->current_ = kib_per_second;
+				utils::http::set_rate_limit(kib_per_second * 1024);
+
+				if (kib_per_second)
+				{
+					console::info("Download rate is limited to %llu KiB/s", static_cast<unsigned long long>(kib_per_second));
+				}
+			}
+
+			void run()
+			{
+				std::unique_lock lock(this->mutex_);
+				while (!this->cv_.wait_for(lock, RATE_LIMIT_POLL_INTERVAL, [this] { return this->stopping_; }))
+				{
+					const auto kib_per_second = load_rate_limit();
+					if (kib_per_second == this->current_)
+					{
+						continue;
+					}
+
+					this->apply(kib_per_second);
+					if (!kib_per_second)
+					{
+						console::info("Download rate limit was removed");
+					}
+				}
+			}
+		};
+	}
+
+	void set_rate_limit(const std::uint64_t kib_per_second)
+	{
+		rate_limit_override = kib_per_second;
+	}
+
+	void set_speculative_download(const bool enabled)
+	{
+		speculative_download_override = enabled;
+	}
+
 	int update_iw4x()
 	{
 		const auto iw4_install = utils::properties::load("iw4-install");
@@ -32,6 +174,60 @@ namespace updater
 
 		file_updater.add_file_to_skip("iw4sp.exe");
 
+		// Dedicated servers can leave out what only the client needs, e.g. iw4x-skip=zone/english/,iw4x/images/
+		for (const auto& pattern : load_list("iw4x-skip"))
+		{
+			file_updater.add_file_to_skip(pattern);
+		}
+
+		for (const auto& pattern : load_list("iw4x-include"))
+		{
+			file_updater.add_file_to_include(pattern);
+		}
+
+		file_updater.set_speculative_download(load_speculative_download());
+
+		if (const auto mirrors = utils::properties::load("iw4x-mirrors"); mirrors.has_value())
+		{
+			for (const auto& mirror : utils::string::split(mirrors.value(), ','))
+			{
+				if (!mirror.empty())
+				{
+					file_updater.add_mirror(mirror);
+				}
+			}
+		}
+
+		// Extracting while downloading is on unless turned off explicitly
+		if (const auto stream_extraction = utils::properties::load("stream-extraction"); stream_extraction.has_value())
+		{
+			file_updater.set_stream_extraction(stream_extraction.value() != "false" && stream_extraction.value() != "0");
+		}
+
+		// Delta updates skip the digest check of the release archive, so they have to be turned on explicitly
+		if (const auto delta_updates = utils::properties::load("delta-updates"); delta_updates.has_value())
+		{
+			file_updater.set_delta_updates(delta_updates.value() == "true" || delta_updates.value() == "1");
+		}
+
+		if (const auto connections = utils::properties::load("download-connections"); connections.has_value())
+		{
+			file_updater.set_download_connections(std::strtoul(connections->c_str(), nullptr, 10));
+		}
+
+		// In MiB
+		if (const auto direct_io = utils::properties::load("direct-io-threshold"); direct_io.has_value())
+		{
+			utils::compression::zip::set_direct_io_threshold(std::strtoull(direct_io->c_str(), nullptr, 10) * 1024 * 1024);
+		}
+
+		if (const auto backend = utils::properties::load("inflate-backend"); backend.has_value()
+			&& !utils::inflate::set_backend(*backend))
+		{
+			console::warn("Unknown inflate backend \"%s\", keeping %s", backend->c_str(), utils::inflate::get_backend().name);
+		}
+
+		const rate_limit_watcher rate_limit_watcher{};
 		return file_updater.update_if_necessary();
 	}
 }
@@ -3,4 +3,10 @@
 namespace updater
 {
 	int update_iw4x();
+
+	// Overrides the "download-rate-limit" property, in KiB/s. 0 means unlimited
+	void set_rate_limit(std::uint64_t kib_per_second);
+
+	// Overrides the "speculative-download" property
+	void set_speculative_download(bool enabled);
 }
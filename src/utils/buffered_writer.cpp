@@ -0,0 +1,143 @@
+#include <std_include.hpp>
+
+#include "buffered_writer.hpp"
+
+namespace utils::io
+{
+	void buffered_writer::buffer_deleter::operator()(std::byte* buffer) const
+	{
+		::operator delete(buffer, std::align_val_t{ALIGNMENT});
+	}
+
+	buffered_writer::buffered_writer(const std::filesystem::path& file, const std::uint64_t expected_size, const bool direct_io)
+		: file_(file)
+	{
+		if (!this->file_.is_open())
+		{
+			return;
+		}
+
+		this->buffer_.reset(static_cast<std::byte*>(::operator new(BUFFER_SIZE, std::align_val_t{ALIGNMENT})));
+
+		if (expected_size)
+		{
+			this->file_.preallocate(expected_size);
+		}
+
+		// Not worth it for files that fit into the buffer, they are written with a single call anyway
+		if (direct_io && expected_size >= BUFFER_SIZE)
+		{
+			this->direct_io_ = this->file_.set_direct_io(true);
+		}
+	}
+
+	buffered_writer::~buffered_writer()
+	{
+		this->close();
+	}
+
+	buffered_writer& buffered_writer::operator=(buffered_writer&& obj) noexcept
+	{
+		if (this != &obj)
+		{
+			this->close();
+
+			this->file_ = std::move(obj.file_);
+			this->buffer_ = std::move(obj.buffer_);
+			this->buffered_ = obj.buffered_;
+			this->direct_io_ = obj.direct_io_;
+			this->failed_ = obj.failed_;
+
+			obj.buffered_ = 0;
+			obj.direct_io_ = false;
+			obj.failed_ = false;
+		}
+
+		return *this;
+	}
+
+	bool buffered_writer::is_open() const
+	{
+		return this->file_.is_open();
+	}
+
+	bool buffered_writer::write(const void* data, std::size_t size)
+	{
+		if (!this->is_open() || this->failed_)
+		{
+			return false;
+		}
+
+		const auto* bytes = static_cast<const std::byte*>(data);
+
+		// Large writes don't need to be copied first, unless direct I/O requires an aligned buffer
+		if (!this->buffered_ && !this->direct_io_ && size >= BUFFER_SIZE)
+		{
+			this->failed_ = !this->file_.write(bytes, size);
+			return !this->failed_;
+		}
+
+		while (size > 0)
+		{
+			const auto chunk = std::min(size, BUFFER_SIZE - this->buffered_);
+			std::memcpy(this->buffer_.get() + this->buffered_, bytes, chunk);
+
+			this->buffered_ += chunk;
+			bytes += chunk;
+			size -= chunk;
+
+			if (this->buffered_ == BUFFER_SIZE && !this->flush())
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool buffered_writer::flush()
+	{
+		if (!this->buffered_)
+		{
+			return true;
+		}
+
+		// A partial block can't be written directly. This only happens at the end of the file
+		if (this->direct_io_ && this->buffered_ % ALIGNMENT)
+		{
+			this->file_.set_direct_io(false);
+			this->direct_io_ = false;
+		}
+
+		auto written = this->file_.write(this->buffer_.get(), this->buffered_);
+		if (!written && this->direct_io_)
+		{
+			// Some filesystems want a different alignment, write it the regular way
+			this->file_.set_direct_io(false);
+			this->direct_io_ = false;
+			written = this->file_.write(this->buffer_.get(), this->buffered_);
+		}
+
+		this->buffered_ = 0;
+		if (!written)
+		{
+			this->failed_ = true;
+		}
+
+		return written;
+	}
+
+	bool buffered_writer::close()
+	{
+		if (!this->is_open())
+		{
+			return !this->failed_;
+		}
+
+		const auto result = this->flush() && !this->failed_;
+		this->file_.close();
+		this->buffer_.reset();
+
+		return result;
+	}
+}
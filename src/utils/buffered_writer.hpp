@@ -0,0 +1,56 @@
+#pragma once
+
+#include "file_writer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+
+namespace utils::io
+{
+	// Collects small writes in a large aligned buffer and passes it on to the file in one call.
+	// The expected size is reserved up front so big files are not extended over and over
+	class buffered_writer
+	{
+	public:
+		static constexpr std::size_t BUFFER_SIZE = 1024 * 1024;
+		static constexpr std::size_t ALIGNMENT = 4096;
+
+		buffered_writer() = default;
+
+		// Direct I/O keeps the file out of the page cache. It is only a hint, the writer falls back to
+		// regular writes wherever the platform or filesystem does not support it
+		explicit buffered_writer(const std::filesystem::path& file, std::uint64_t expected_size = 0, bool direct_io = false);
+
+		// Closes the file, data that could not be written is lost silently. Use close() to find out
+		~buffered_writer();
+
+		buffered_writer(buffered_writer&& obj) noexcept = default;
+		buffered_writer& operator=(buffered_writer&& obj) noexcept;
+
+		buffered_writer(const buffered_writer&) = delete;
+		buffered_writer& operator=(const buffered_writer&) = delete;
+
+		[[nodiscard]] bool is_open() const;
+
+		bool write(const void* data, std::size_t size);
+
+		// Writes whatever is still buffered and closes the file. Returns false if any write failed
+		bool close();
+
+	private:
+		struct buffer_deleter
+		{
+			void operator()(std::byte* buffer) const;
+		};
+
+		file_writer file_;
+		std::unique_ptr<std::byte, buffer_deleter> buffer_;
+		std::size_t buffered_ = 0;
+		bool direct_io_ = false;
+		bool failed_ = false;
+
+		bool flush();
+	};
+}
@@ -9,7 +9,12 @@
 
 #include <gsl/gsl>
 
+#include "buffered_writer.hpp"
+#include "crc32.hpp"
+#include "directory_cache.hpp"
+#include "inflate.hpp"
 #include "io.hpp"
+#include "mapped_file.hpp"
 #include "string.hpp"
 
 #ifndef MAX_PATH
@@ -20,83 +25,45 @@ namespace utils::compression
 {
 	namespace zlib
 	{
-		namespace
+		std::string decompress(const std::string& data)
 		{
-			class zlib_stream
+			// zlib header (RFC 1950): deflate with at most a 32K window and no preset dictionary
+			if (data.size() < 6)
 			{
-			public:
-				zlib_stream()
-				{
-					memset(&stream_, 0, sizeof(stream_));
-					valid_ = inflateInit(&stream_) == Z_OK;
-				}
-
-				zlib_stream(zlib_stream&&) = delete;
-				zlib_stream(const zlib_stream&) = delete;
-				zlib_stream& operator=(zlib_stream&&) = delete;
-				zlib_stream& operator=(const zlib_stream&) = delete;
-
-				~zlib_stream()
-				{
-					if (valid_)
-					{
-						inflateEnd(&stream_);
-					}
-				}
+				return {};
+			}
 
-				z_stream& get()
-				{
-					return stream_;
-				}
+			const auto cmf = static_cast<std::uint8_t>(data[0]);
+			const auto flg = static_cast<std::uint8_t>(data[1]);
+			if ((cmf & 0x0F) != Z_DEFLATED || (cmf >> 4) > 7 || ((cmf << 8) | flg) % 31 || (flg & 0x20))
+			{
+				return {};
+			}
 
-				[[nodiscard]] bool is_valid() const
-				{
-					return valid_;
-				}
+			std::string buffer{};
+			auto checksum = adler32(0, nullptr, 0);
 
-			private:
-				bool valid_{false};
-				z_stream stream_{};
+			std::size_t consumed = 0;
+			const auto input = std::as_bytes(std::span(data)).subspan(2);
+			const auto append = [&](const std::uint8_t* chunk, const std::size_t size)
+			{
+				buffer.append(reinterpret_cast<const char*>(chunk), size);
+				checksum = adler32(checksum, chunk, static_cast<uInt>(size));
+				return true;
 			};
-		}
 
-		std::string decompress(const std::string& data)
-		{
-			std::string buffer{};
-			zlib_stream stream_container{};
-			if (!stream_container.is_valid())
+			if (!inflate::inflate_raw(input, append, &consumed) || input.size() - consumed < 4)
 			{
 				return {};
 			}
 
-			int ret{};
-			size_t offset = 0;
-			static thread_local uint8_t dest[CHUNK] = {0};
-			auto& stream = stream_container.get();
-
-			do
+			const auto* trailer = reinterpret_cast<const std::uint8_t*>(input.data() + consumed);
+			const auto expected = (static_cast<std::uint32_t>(trailer[0]) << 24) | (static_cast<std::uint32_t>(trailer[1]) << 16)
+				| (static_cast<std::uint32_t>(trailer[2]) << 8) | trailer[3];
+			if (expected != checksum)
 			{
-				const auto input_size = std::min(sizeof(dest), data.size() - offset);
-				stream.avail_in = static_cast<uInt>(input_size);
-				stream.next_in = reinterpret_cast<const Bytef*>(data.data()) + offset;
-				offset += stream.avail_in;
-
-				do
-				{
-					stream.avail_out = sizeof(dest);
-					stream.next_out = dest;
-
-					ret = inflate(&stream, Z_NO_FLUSH);
-					if (ret != Z_OK && ret != Z_STREAM_END)
-					{
-						return {};
-					}
-
-					buffer.insert(buffer.end(), dest, dest + sizeof(dest) - stream.avail_out);
-				}
-				while (stream.avail_out == 0);
+				return {};
 			}
-			while (ret != Z_STREAM_END);
 
 			return buffer;
 		}
@@ -123,169 +90,1724 @@ namespace utils::compression
 	{
 		namespace
 		{
-			constexpr std::size_t READ_BUFFER_SIZE = 65336;
+			constexpr std::size_t READ_BUFFER_SIZE = 65536;
+
+			// Entries at least this big are written with direct I/O, 0 turns it off
+			std::atomic_uint64_t direct_io_threshold = 0;
+
+			io::buffered_writer open_output(const std::filesystem::path& path, const std::uint64_t size)
+			{
+				const auto threshold = direct_io_threshold.load();
+				return io::buffered_writer(path, size, threshold && size >= threshold);
+			}
+
+			// Upper bound on the data waiting for the stream extractor, feed() blocks beyond it
+			constexpr std::size_t MAX_QUEUED_BYTES = 16 * 1024 * 1024;
+
+			constexpr std::uint32_t LOCAL_HEADER_SIGNATURE = 0x04034b50;
+			constexpr std::uint32_t DATA_DESCRIPTOR_SIGNATURE = 0x08074b50;
+			constexpr std::uint32_t CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+			constexpr std::uint32_t END_OF_CENTRAL_DIRECTORY_SIGNATURE = 0x06054b50;
+			constexpr std::uint32_t ZIP64_END_OF_CENTRAL_DIRECTORY_SIGNATURE = 0x06064b50;
+
+			constexpr std::uint32_t ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIGNATURE = 0x07064b50;
+
+			constexpr std::size_t LOCAL_HEADER_SIZE = 30;
+			constexpr std::size_t CENTRAL_HEADER_SIZE = 46;
+			constexpr std::size_t END_OF_CENTRAL_DIRECTORY_SIZE = 22;
+			constexpr std::size_t ZIP64_END_OF_CENTRAL_DIRECTORY_SIZE = 56;
+			constexpr std::size_t ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIZE = 20;
+
+			constexpr std::uint16_t ZIP64_EXTRA_FIELD = 0x0001;
+			constexpr std::uint32_t ZIP64_MARKER = 0xFFFFFFFF;
+
+			constexpr std::uint16_t FLAG_ENCRYPTED = 1 << 0;
+			constexpr std::uint16_t FLAG_DATA_DESCRIPTOR = 1 << 3;
 
-			bool add_file(zipFile& zip_file, const std::string& filename, const std::string& data)
+			constexpr std::uint16_t METHOD_STORE = 0;
+			constexpr std::uint16_t METHOD_DEFLATE = 8;
+
+			std::uint16_t read_16(const std::uint8_t* data)
+			{
+				return static_cast<std::uint16_t>(data[0] | (data[1] << 8));
+			}
+
+			std::uint32_t read_32(const std::uint8_t* data)
+			{
+				return static_cast<std::uint32_t>(read_16(data)) | (static_cast<std::uint32_t>(read_16(data + 2)) << 16);
+			}
+
+			std::uint64_t read_64(const std::uint8_t* data)
+			{
+				return static_cast<std::uint64_t>(read_32(data)) | (static_cast<std::uint64_t>(read_32(data + 4)) << 32);
+			}
+
+			// Finds the ZIP64 extended information in an extra field block
+			std::optional<std::pair<const std::uint8_t*, std::size_t>> find_zip64_extra(const std::uint8_t* extra, std::size_t size)
 			{
-				const auto zip_64 = data.size() > 0xffffffff ? 1 : 0;
-				if (ZIP_OK != zipOpenNewFileInZip64(zip_file, filename.c_str(), nullptr, nullptr, 0, nullptr, 0, nullptr,
-				                                    Z_DEFLATED, Z_BEST_COMPRESSION, zip_64))
+				while (size >= 4)
 				{
-					return false;
+					const auto tag = read_16(extra);
+					const auto length = read_16(extra + 2);
+					if (length > size - 4)
+					{
+						break;
+					}
+
+					if (tag == ZIP64_EXTRA_FIELD)
+					{
+						return {{extra + 4, length}};
+					}
+
+					extra += 4 + length;
+					size -= 4 + length;
 				}
 
-				const auto _ = gsl::finally([&zip_file]() -> void
+				return {};
+			}
+
+			std::string get_entry_name(std::string name)
+			{
+#ifndef _WIN32
+				// Fix for UNIX Systems. Some programs like unzip treat this as a warning
+				std::replace(name.begin(), name.end(), '\\', '/');
+#endif
+				return name;
+			}
+
+			bool is_directory_entry(const std::string& name)
+			{
+				return !name.empty() && (name.back() == '/' || name.back() == '\\');
+			}
+
+			// minizip reads archives in memory through these. Every opened unzFile keeps its own position,
+			// the data itself is shared
+			struct memory_stream
+			{
+				std::span<const std::byte> data;
+				std::uint64_t position = 0;
+			};
+
+			voidpf memory_open(const voidpf opaque, const void* /*filename*/, const int mode)
+			{
+				if ((mode & ZLIB_FILEFUNC_MODE_READWRITEFILTER) != ZLIB_FILEFUNC_MODE_READ)
 				{
-					zipCloseFileInZip(zip_file);
-				});
+					return nullptr;
+				}
 
-				return ZIP_OK == zipWriteInFileInZip(zip_file, data.c_str(), static_cast<unsigned>(data.size()));
+				return new memory_stream{*static_cast<const std::span<const std::byte>*>(opaque)};
 			}
-		}
 
-		void archive::add(const std::string& filename, const std::string& data)
-		{
-			this->files_[filename] = data;
-		}
+			uLong memory_read(voidpf /*opaque*/, const voidpf stream, void* buf, const uLong size)
+			{
+				auto* memory = static_cast<memory_stream*>(stream);
+				const auto count = static_cast<std::size_t>(std::min<std::uint64_t>(size, memory->data.size() - memory->position));
 
-		bool archive::write(const std::string& filename, const std::string& comment)
-		{
-			// Hack to create the directory :3
-			io::write_file(filename, {});
-			io::remove_file(filename);
+				std::memcpy(buf, memory->data.data() + memory->position, count);
+				memory->position += count;
 
-			auto* zip_file = zipOpen64(filename.c_str(), false);
-			if (!zip_file)
+				return static_cast<uLong>(count);
+			}
+
+			uLong memory_write(voidpf /*opaque*/, voidpf /*stream*/, const void* /*buf*/, uLong /*size*/)
 			{
-				return false;
+				return 0;
 			}
 
-			const auto _ = gsl::finally([&zip_file, &comment]() -> void
+			ZPOS64_T memory_tell(voidpf /*opaque*/, const voidpf stream)
 			{
-				zipClose(zip_file, comment.empty() ? nullptr : comment.c_str());
-			});
+				return static_cast<memory_stream*>(stream)->position;
+			}
 
-			for (const auto& file : this->files_)
+			long memory_seek(voidpf /*opaque*/, const voidpf stream, const ZPOS64_T offset, const int origin)
 			{
-				if (!add_file(zip_file, file.first, file.second))
+				auto* memory = static_cast<memory_stream*>(stream);
+				const std::uint64_t size = memory->data.size();
+
+				std::uint64_t position;
+				switch (origin)
 				{
-					return false;
+				case ZLIB_FILEFUNC_SEEK_SET:
+					position = offset;
+					break;
+				case ZLIB_FILEFUNC_SEEK_CUR:
+					position = memory->position + offset;
+					break;
+				case ZLIB_FILEFUNC_SEEK_END:
+					position = size + offset;
+					break;
+				default:
+					return -1;
 				}
-			}
 
-			return true;
-		}
+				if (position > size)
+				{
+					return -1;
+				}
 
-		// I apologize for writing such a huge function
-		// I'm using make_preferred() so / are converted to \\ on Windows but not on POSIX
-		void archive::decompress(const std::string& filename, const std::filesystem::path& out_dir)
-		{
-			unzFile file = unzOpen(filename.c_str());
-			if (!file)
-			{
-				throw std::runtime_error(string::va("unzOpen failed on %s", filename.c_str()));
+				memory->position = position;
+				return 0;
 			}
 
-			unz_global_info global_info;
-			if (unzGetGlobalInfo(file, &global_info) != UNZ_OK)
+			int memory_close(voidpf /*opaque*/, const voidpf stream)
 			{
-				unzClose(file);
-				throw std::runtime_error(string::va("unzGetGlobalInfo failed on %s", filename.c_str()));
+				delete static_cast<memory_stream*>(stream);
+				return 0;
 			}
 
-			const auto read_buffer_large = std::make_unique<char[]>(READ_BUFFER_SIZE);
-			// No need to memset this to 0
-			auto* read_buffer = read_buffer_large.get();
+			int memory_error(voidpf /*opaque*/, voidpf /*stream*/)
+			{
+				return 0;
+			}
 
-			// Loop to extract all the files
-			for (std::size_t i = 0; i < global_info.number_entry; ++i)
+			// The span only has to live until the call returns
+			unzFile open_memory(std::span<const std::byte>& data)
 			{
-				// Get info about the current file.
-				unz_file_info file_info;
-				char filename_buffer[MAX_PATH]{};
+				zlib_filefunc64_def functions{};
+				functions.zopen64_file = memory_open;
+				functions.zread_file = memory_read;
+				functions.zwrite_file = memory_write;
+				functions.ztell64_file = memory_tell;
+				functions.zseek64_file = memory_seek;
+				functions.zclose_file = memory_close;
+				functions.zerror_file = memory_error;
+				functions.opaque = &data;
 
-				if (unzGetCurrentFileInfo(file, &file_info, filename_buffer, sizeof(filename_buffer) - 1,
-				                          nullptr, 0, nullptr, 0) != UNZ_OK)
+				unzFile file = unzOpen2_64("", &functions);
+				if (!file)
 				{
-					continue;
+					throw std::runtime_error("unzOpen2_64 failed on an archive in memory");
 				}
 
-				// Check if this entry is a directory or a file.
-				std::string out_file = filename_buffer;
-#ifndef _WIN32
-				// Fix for UNIX Systems. Some programs like unzip treat this as a warning
-				std::replace(out_file.begin(), out_file.end(), '\\', '/');
-#endif
+				return file;
+			}
+
+			// Parses the central directory records, stops at the first byte that is not one
+			std::optional<std::vector<entry_info>> parse_central_directory(const std::uint8_t*& data, std::size_t& size)
+			{
+				std::vector<entry_info> entries{};
+				while (size >= 4 && read_32(data) == CENTRAL_HEADER_SIGNATURE)
+				{
+					if (size < CENTRAL_HEADER_SIZE)
+					{
+						return {};
+					}
+
+					const auto name_length = read_16(data + 28);
+					const auto extra_length = read_16(data + 30);
+					const auto comment_length = read_16(data + 32);
+					const auto record_size = CENTRAL_HEADER_SIZE + name_length + extra_length + comment_length;
+					if (size < record_size)
+					{
+						return {};
+					}
+
+					entry_info entry{};
+					entry.name = get_entry_name({reinterpret_cast<const char*>(data + CENTRAL_HEADER_SIZE), name_length});
+					entry.flags = read_16(data + 8);
+					entry.method = read_16(data + 10);
+					entry.crc = read_32(data + 16);
+					entry.compressed_size = read_32(data + 20);
+					entry.uncompressed_size = read_32(data + 24);
+					entry.local_header_offset = read_32(data + 42);
+
+					if (const auto zip64 = find_zip64_extra(data + CENTRAL_HEADER_SIZE + name_length, extra_length))
+					{
+						auto [field, field_size] = *zip64;
+						for (auto* value : {&entry.uncompressed_size, &entry.compressed_size, &entry.local_header_offset})
+						{
+							if (*value != ZIP64_MARKER)
+							{
+								continue;
+							}
+
+							if (field_size < 8)
+							{
+								return {};
+							}
+
+							*value = read_64(field);
+							field += 8;
+							field_size -= 8;
+						}
+					}
+
+					entries.emplace_back(std::move(entry));
+					data += record_size;
+					size -= record_size;
+				}
+
+				return {std::move(entries)};
+			}
+
+			// Big enough that priming every block with the window before it costs next to nothing
+			constexpr std::size_t DEFLATE_BLOCK_SIZE = 1024 * 1024;
+			constexpr std::size_t DEFLATE_WINDOW_SIZE = 32 * 1024;
+
+			// Blocks being deflated or waiting to be written, per thread
+			constexpr std::size_t BLOCKS_PER_THREAD = 2;
 
-				const auto filename_length = out_file.size();
-				if (out_file[filename_length - 1] == '/' || out_file[filename_length - 1] == '\\') // ZIP is not directory-separator-agnostic
+			// Entries close to 4 GB get the ZIP64 fields as well, their compressed size could still pass it
+			constexpr std::uint64_t ZIP64_THRESHOLD = 0xF0000000;
+
+			// Spread over the entry, so a compressible header doesn't hide incompressible data behind it
+			constexpr std::size_t PROBE_SAMPLES = 4;
+			constexpr std::size_t PROBE_SAMPLE_SIZE = 4096;
+
+			// Compressed to sample size, in percent
+			constexpr std::size_t PROBE_STORE_RATIO = 95;
+			constexpr std::size_t PROBE_FAST_RATIO = 75;
+
+			struct deflate_entry
+			{
+				const std::string* name;
+				io::mapped_file file;
+				std::span<const std::byte> data;
+				std::uint32_t crc;
+				int level;
+			};
+
+			// A piece of an entry that is deflated on its own, pigz style. Every block but the last ends with a
+			// sync flush, so the compressed blocks simply follow each other in the entry
+			struct deflate_block
+			{
+				deflate_entry* entry;
+				std::span<const std::byte> dictionary;
+				std::span<const std::byte> input;
+				bool first;
+				bool last;
+
+				std::vector<std::uint8_t> output;
+				std::uint32_t crc;
+				bool failed;
+				bool done;
+			};
+
+			class block_deflater
+			{
+			public:
+				block_deflater()
 				{
-					// Entry is a directory. Create it.
-					auto dir = out_dir / out_file;
-					io::create_directory(dir.make_preferred());
+					this->valid_ = deflateInit2(&this->stream_, this->level_, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
 				}
-				else
+
+				~block_deflater()
 				{
-					// Entry is a file. Extract it.
-					if (unzOpenCurrentFile(file) != UNZ_OK)
+					if (this->valid_)
 					{
-						unzClose(file);
-						throw std::runtime_error(string::va("Failed to read file \"%s\" from \"%s\"", out_file.c_str(), filename.c_str()));
+						deflateEnd(&this->stream_);
 					}
-					
-					auto path = out_dir / out_file;
-					// Must create any directories before opening a stream
-					if (auto parent_path = path.parent_path(); !parent_path.empty())
+				}
+
+				block_deflater(block_deflater&&) = delete;
+				block_deflater(const block_deflater&) = delete;
+				block_deflater& operator=(block_deflater&&) = delete;
+				block_deflater& operator=(const block_deflater&) = delete;
+
+				bool deflate(deflate_block& block)
+				{
+					block.crc = crc32::update(0, block.input);
+
+					// Stored blocks are written straight from the input
+					if (!block.entry->level)
 					{
-						io::create_directory(parent_path.make_preferred());
+						return true;
 					}
 
-					std::ofstream out(path.make_preferred().string(), std::ios::binary | std::ios::trunc);
-					if (!out.is_open())
+					if (!this->valid_ || deflateReset(&this->stream_) != Z_OK)
 					{
-						unzCloseCurrentFile(file);
-						unzClose(file);
-						throw std::runtime_error("Failed to open stream");
+						return false;
 					}
 
-					auto read_bytes = 0;
-					while (true)
+					if (block.entry->level != this->level_)
 					{
-						read_bytes = unzReadCurrentFile(file, read_buffer, READ_BUFFER_SIZE);
-						if (read_bytes < 0)
+						if (deflateParams(&this->stream_, block.entry->level, Z_DEFAULT_STRATEGY) != Z_OK)
 						{
-							unzCloseCurrentFile(file);
-							unzClose(file);
-							throw std::runtime_error(string::va("Error while reading \"%s\" from the archive", out_file.c_str()));
+							return false;
 						}
 
-						if (read_bytes > 0)
+						this->level_ = block.entry->level;
+					}
+
+					if (!block.dictionary.empty() && deflateSetDictionary(&this->stream_, reinterpret_cast<const Bytef*>(block.dictionary.data()),
+					                                                      static_cast<uInt>(block.dictionary.size())) != Z_OK)
+					{
+						return false;
+					}
+
+					// The bound covers the end of the stream, a sync flush adds at most an empty stored block
+					block.output.resize(deflateBound(&this->stream_, static_cast<uLong>(block.input.size())) + 16);
+
+					this->stream_.next_in = reinterpret_cast<const Bytef*>(block.input.data());
+					this->stream_.avail_in = static_cast<uInt>(block.input.size());
+					this->stream_.next_out = block.output.data();
+					this->stream_.avail_out = static_cast<uInt>(block.output.size());
+
+					const auto result = ::deflate(&this->stream_, block.last ? Z_FINISH : Z_SYNC_FLUSH);
+					if (this->stream_.avail_in || (block.last ? result != Z_STREAM_END : result != Z_OK || !this->stream_.avail_out))
+					{
+						return false;
+					}
+
+					block.output.resize(block.output.size() - this->stream_.avail_out);
+					return true;
+				}
+
+			private:
+				z_stream stream_{};
+				int level_ = Z_BEST_COMPRESSION;
+				bool valid_ = false;
+			};
+
+			bool write_block(zipFile zip_file, const deflate_block& block)
+			{
+				auto& entry = *block.entry;
+				if (block.first && ZIP_OK != zipOpenNewFileInZip2_64(zip_file, entry.name->c_str(), nullptr, nullptr, 0, nullptr, 0, nullptr,
+				                                                     entry.level ? Z_DEFLATED : METHOD_STORE, entry.level, 1,
+				                                                     entry.data.size() >= ZIP64_THRESHOLD ? 1 : 0))
+				{
+					return false;
+				}
+
+				entry.crc = static_cast<std::uint32_t>(crc32_combine(entry.crc, block.crc, static_cast<z_off_t>(block.input.size())));
+
+				const auto* data = entry.level ? block.output.data() : reinterpret_cast<const std::uint8_t*>(block.input.data());
+				const auto size = entry.level ? block.output.size() : block.input.size();
+				if (size && ZIP_OK != zipWriteInFileInZip(zip_file, data, static_cast<unsigned>(size)))
+				{
+					return false;
+				}
+
+				return !block.last || ZIP_OK == zipCloseFileInZipRaw64(zip_file, entry.data.size(), entry.crc);
+			}
+
+			// Extracts entries from their local records as the bytes come in
+			class record_parser
+			{
+			public:
+				// position is the offset of the first byte in the archive
+				explicit record_parser(std::filesystem::path out_dir, const std::uint64_t position = 0, entry_filter filter = {})
+					: out_dir_(std::move(out_dir))
+					, filter_(std::move(filter))
+					, buffer_(std::make_unique<std::uint8_t[]>(READ_BUFFER_SIZE))
+					, position_(position)
+				{
+				}
+
+				~record_parser()
+				{
+					this->end_inflate();
+				}
+
+				record_parser(record_parser&&) = delete;
+				record_parser(const record_parser&) = delete;
+				record_parser& operator=(record_parser&&) = delete;
+				record_parser& operator=(const record_parser&) = delete;
+
+				bool parse(const std::uint8_t* data, std::size_t size)
+				{
+					while (size > 0 && this->error_.empty())
+					{
+						switch (this->state_)
 						{
-							out.write(read_buffer, read_bytes);
+						case state::header:
+							this->parse_header(data, size);
+							break;
+						case state::entry_data:
+							this->parse_entry_data(data, size);
+							break;
+						case state::data_descriptor:
+							this->parse_data_descriptor(data, size);
+							break;
+						case state::central_directory:
+							this->central_directory_.append(reinterpret_cast<const char*>(data), size);
+							this->position_ += size;
+							size = 0;
+							break;
 						}
-						else
+					}
+
+					return this->error_.empty();
+				}
+
+				bool verify()
+				{
+					if (!this->error_.empty())
+					{
+						return false;
+					}
+
+					if (this->state_ != state::central_directory)
+					{
+						return this->fail("Archive ended before its central directory");
+					}
+
+					const auto* data = reinterpret_cast<const std::uint8_t*>(this->central_directory_.data());
+					auto size = this->central_directory_.size();
+
+					const auto entries = parse_central_directory(data, size);
+					if (!entries || size < 4 || (read_32(data) != END_OF_CENTRAL_DIRECTORY_SIGNATURE
+						&& read_32(data) != ZIP64_END_OF_CENTRAL_DIRECTORY_SIGNATURE))
+					{
+						return this->fail("Invalid central directory");
+					}
+
+					if (entries->size() != this->extracted_.size())
+					{
+						return this->fail(string::va("Central directory lists %zu entries, %zu were extracted", entries->size(), this->extracted_.size()));
+					}
+
+					std::unordered_map<std::uint64_t, const entry_info*> extracted_by_offset{};
+					for (const auto& entry : this->extracted_)
+					{
+						extracted_by_offset[entry.local_header_offset] = &entry;
+					}
+
+					for (const auto& entry : *entries)
+					{
+						const auto extracted = extracted_by_offset.find(entry.local_header_offset);
+						if (extracted == extracted_by_offset.end()
+							|| extracted->second->name != entry.name
+							|| extracted->second->crc != entry.crc
+							|| extracted->second->uncompressed_size != entry.uncompressed_size)
 						{
-							// No more data to read, the loop will break
-							// This is normal behaviour
-							break;
+							return this->fail(string::va("Entry \"%s\" does not match the central directory", entry.name.c_str()));
 						}
 					}
 
-					out.close();
+					return true;
 				}
 
-				// Go the the next entry listed in the ZIP file.
-				if ((i + 1) < global_info.number_entry)
+				// Checks that exactly the expected entry was extracted
+				bool verify_entry(const entry_info& expected)
 				{
-					// According to the AI overlords I do not need to close the file with unzCloseCurrentFile here
-					if (unzGoToNextFile(file) != UNZ_OK)
+					if (!this->error_.empty())
 					{
-						break;
+						return false;
+					}
+
+					if (this->state_ != state::header || !this->pending_.empty() || this->extracted_.size() != 1)
+					{
+						return this->fail(string::va("Incomplete record for \"%s\"", expected.name.c_str()));
 					}
+
+					const auto& entry = this->extracted_.front();
+					if (entry.name != expected.name || entry.crc != expected.crc
+						|| entry.uncompressed_size != expected.uncompressed_size
+						|| entry.local_header_offset != expected.local_header_offset)
+					{
+						return this->fail(string::va("Entry \"%s\" does not match the central directory", expected.name.c_str()));
+					}
+
+					return true;
 				}
-			}
 
-			unzClose(file);
+				[[nodiscard]] const std::string& get_error() const
+				{
+					return this->error_;
+				}
+
+				[[nodiscard]] std::size_t get_entry_count() const
+				{
+					return this->extracted_.size() - this->skipped_;
+				}
+
+			private:
+				enum class state
+				{
+					header,
+					entry_data,
+					data_descriptor,
+					central_directory,
+				};
+
+				struct entry
+				{
+					entry_info info{};
+					bool zip64{};
+					std::uint64_t consumed{};
+					std::uint64_t written{};
+					std::uint32_t crc{};
+					io::buffered_writer out{};
+
+					// Rejected by the filter. Only entries that end in a data descriptor are still inflated,
+					// there is no other way to find their end
+					bool skipped{};
+
+					[[nodiscard]] bool is_passed_over() const
+					{
+						return this->skipped && !(this->info.flags & FLAG_DATA_DESCRIPTOR);
+					}
+				};
+
+				std::filesystem::path out_dir_;
+				entry_filter filter_;
+				io::directory_cache directories_;
+				std::unique_ptr<std::uint8_t[]> buffer_;
+
+				state state_ = state::header;
+				std::string pending_{};
+				std::uint64_t position_;
+				std::string error_{};
+
+				entry current_{};
+				std::vector<entry_info> extracted_{};
+				std::size_t skipped_ = 0;
+				std::string central_directory_{};
+
+				z_stream stream_{};
+				bool inflating_ = false;
+
+				bool fail(std::string error)
+				{
+					this->error_ = std::move(error);
+					return false;
+				}
+
+				// Moves bytes into pending_ until it holds the requested amount
+				bool fill(const std::size_t needed, const std::uint8_t*& data, std::size_t& size)
+				{
+					if (this->pending_.size() < needed)
+					{
+						const auto count = std::min(needed - this->pending_.size(), size);
+						this->pending_.append(reinterpret_cast<const char*>(data), count);
+						this->position_ += count;
+						data += count;
+						size -= count;
+					}
+
+					return this->pending_.size() >= needed;
+				}
+
+				[[nodiscard]] const std::uint8_t* pending_data() const
+				{
+					return reinterpret_cast<const std::uint8_t*>(this->pending_.data());
+				}
+
+				void parse_header(const std::uint8_t*& data, std::size_t& size)
+				{
+					const auto header_offset = this->position_ - this->pending_.size();
+					if (!this->fill(4, data, size))
+					{
+						return;
+					}
+
+					const auto signature = read_32(this->pending_data());
+					if (signature == CENTRAL_HEADER_SIGNATURE || signature == END_OF_CENTRAL_DIRECTORY_SIGNATURE
+						|| signature == ZIP64_END_OF_CENTRAL_DIRECTORY_SIGNATURE)
+					{
+						this->central_directory_ = std::move(this->pending_);
+						this->pending_.clear();
+						this->state_ = state::central_directory;
+						return;
+					}
+
+					if (signature != LOCAL_HEADER_SIGNATURE)
+					{
+						this->fail(string::va("Unexpected signature 0x%08X at offset %llu", signature, static_cast<unsigned long long>(header_offset)));
+						return;
+					}
+
+					if (!this->fill(LOCAL_HEADER_SIZE, data, size))
+					{
+						return;
+					}
+
+					const auto name_length = read_16(this->pending_data() + 26);
+					const auto extra_length = read_16(this->pending_data() + 28);
+					if (!this->fill(LOCAL_HEADER_SIZE + name_length + extra_length, data, size))
+					{
+						return;
+					}
+
+					const auto* header = this->pending_data();
+
+					this->current_ = {};
+					auto& info = this->current_.info;
+					info.name = get_entry_name({reinterpret_cast<const char*>(header + LOCAL_HEADER_SIZE), name_length});
+					info.flags = read_16(header + 6);
+					info.method = read_16(header + 8);
+					info.crc = read_32(header + 14);
+					info.compressed_size = read_32(header + 18);
+					info.uncompressed_size = read_32(header + 22);
+					info.local_header_offset = header_offset;
+
+					if (const auto zip64 = find_zip64_extra(header + LOCAL_HEADER_SIZE + name_length, extra_length))
+					{
+						this->current_.zip64 = true;
+
+						// The local header always carries both sizes
+						const auto [field, field_size] = *zip64;
+						if (field_size >= 16)
+						{
+							info.uncompressed_size = read_64(field);
+							info.compressed_size = read_64(field + 8);
+						}
+					}
+
+					this->pending_.clear();
+					this->start_entry();
+				}
+
+				void start_entry()
+				{
+					auto& current = this->current_;
+					current.skipped = this->filter_ && !this->filter_(current.info.name);
+
+					// The data of an entry that is passed over is never looked at
+					const auto passed_over = current.is_passed_over();
+					if ((current.info.flags & FLAG_ENCRYPTED) && !passed_over)
+					{
+						this->fail(string::va("Entry \"%s\" is encrypted", current.info.name.c_str()));
+						return;
+					}
+
+					if (current.info.method != METHOD_STORE && current.info.method != METHOD_DEFLATE && !passed_over)
+					{
+						this->fail(string::va("Entry \"%s\" uses unsupported compression method %u", current.info.name.c_str(), current.info.method));
+						return;
+					}
+
+					// Stored entries with a data descriptor have no way to tell where they end
+					if (current.info.method == METHOD_STORE && (current.info.flags & FLAG_DATA_DESCRIPTOR))
+					{
+						this->fail(string::va("Entry \"%s\" is stored without a known size", current.info.name.c_str()));
+						return;
+					}
+
+					auto path = this->out_dir_ / current.info.name;
+					if (current.skipped)
+					{
+						++this->skipped_;
+					}
+					else if (is_directory_entry(current.info.name))
+					{
+						this->directories_.create(path.make_preferred());
+					}
+					else
+					{
+						this->directories_.create_parent(path.make_preferred());
+
+						// The sizes in the header are only known up front without a data descriptor
+						const auto size = (current.info.flags & FLAG_DATA_DESCRIPTOR) ? 0 : current.info.uncompressed_size;
+						current.out = open_output(path.make_preferred(), size);
+						if (!current.out.is_open())
+						{
+							this->fail(string::va("Failed to open \"%s\" for writing", current.info.name.c_str()));
+							return;
+						}
+					}
+
+					if (current.info.method == METHOD_DEFLATE && !passed_over)
+					{
+						this->stream_ = {};
+						if (inflateInit2(&this->stream_, -MAX_WBITS) != Z_OK)
+						{
+							this->fail("inflateInit2 failed");
+							return;
+						}
+
+						this->inflating_ = true;
+					}
+
+					this->state_ = state::entry_data;
+
+					// Nothing follows the header of an empty stored entry
+					if ((current.info.method == METHOD_STORE || passed_over) && !current.info.compressed_size)
+					{
+						this->end_entry();
+					}
+				}
+
+				bool write(const std::uint8_t* data, const std::size_t size)
+				{
+					if (!size)
+					{
+						return true;
+					}
+
+					auto& current = this->current_;
+					if (!current.skipped && (!current.out.is_open() || !current.out.write(data, size)))
+					{
+						return this->fail(string::va("Failed to write \"%s\"", current.info.name.c_str()));
+					}
+
+					current.crc = crc32::update(current.crc, data, size);
+					current.written += size;
+					return true;
+				}
+
+				void parse_entry_data(const std::uint8_t*& data, std::size_t& size)
+				{
+					auto& current = this->current_;
+					if (current.info.method == METHOD_STORE || current.is_passed_over())
+					{
+						const auto count = static_cast<std::size_t>(std::min<std::uint64_t>(size, current.info.compressed_size - current.consumed));
+						if (!current.is_passed_over() && !this->write(data, count))
+						{
+							return;
+						}
+
+						current.consumed += count;
+						this->position_ += count;
+						data += count;
+						size -= count;
+
+						if (current.consumed == current.info.compressed_size)
+						{
+							this->end_entry();
+						}
+
+						return;
+					}
+
+					auto& stream = this->stream_;
+					stream.next_in = data;
+					stream.avail_in = static_cast<uInt>(std::min<std::size_t>(size, std::numeric_limits<uInt>::max()));
+					const auto available = stream.avail_in;
+
+					auto result = Z_OK;
+					while (stream.avail_in > 0 && result != Z_STREAM_END)
+					{
+						stream.next_out = this->buffer_.get();
+						stream.avail_out = static_cast<uInt>(READ_BUFFER_SIZE);
+
+						result = ::inflate(&stream, Z_NO_FLUSH);
+						if (result != Z_OK && result != Z_STREAM_END)
+						{
+							this->fail(string::va("Failed to inflate \"%s\"", current.info.name.c_str()));
+							return;
+						}
+
+						if (!this->write(this->buffer_.get(), READ_BUFFER_SIZE - stream.avail_out))
+						{
+							return;
+						}
+					}
+
+					// Whatever inflate left over belongs to the next record
+					const auto consumed = available - stream.avail_in;
+					current.consumed += consumed;
+					this->position_ += consumed;
+					data += consumed;
+					size -= consumed;
+
+					if (result == Z_STREAM_END)
+					{
+						this->end_inflate();
+						this->end_entry();
+					}
+				}
+
+				void end_inflate()
+				{
+					if (this->inflating_)
+					{
+						inflateEnd(&this->stream_);
+						this->inflating_ = false;
+					}
+				}
+
+				void end_entry()
+				{
+					if (this->current_.info.flags & FLAG_DATA_DESCRIPTOR)
+					{
+						this->state_ = state::data_descriptor;
+						return;
+					}
+
+					this->complete_entry();
+				}
+
+				void parse_data_descriptor(const std::uint8_t*& data, std::size_t& size)
+				{
+					// The signature is optional
+					if (!this->fill(4, data, size))
+					{
+						return;
+					}
+
+					const auto has_signature = read_32(this->pending_data()) == DATA_DESCRIPTOR_SIGNATURE;
+					const auto sizes_offset = has_signature ? 8u : 4u;
+					const auto descriptor_size = sizes_offset + (this->current_.zip64 ? 16u : 8u);
+					if (!this->fill(descriptor_size, data, size))
+					{
+						return;
+					}
+
+					const auto* descriptor = this->pending_data();
+					auto& info = this->current_.info;
+					info.crc = read_32(descriptor + sizes_offset - 4);
+
+					if (this->current_.zip64)
+					{
+						info.compressed_size = read_64(descriptor + sizes_offset);
+						info.uncompressed_size = read_64(descriptor + sizes_offset + 8);
+					}
+					else
+					{
+						info.compressed_size = read_32(descriptor + sizes_offset);
+						info.uncompressed_size = read_32(descriptor + sizes_offset + 4);
+					}
+
+					this->pending_.clear();
+					this->complete_entry();
+				}
+
+				void complete_entry()
+				{
+					auto& current = this->current_;
+					if (current.is_passed_over())
+					{
+						this->extracted_.emplace_back(std::move(current.info));
+						this->state_ = state::header;
+						return;
+					}
+
+					if (current.consumed != current.info.compressed_size || current.written != current.info.uncompressed_size)
+					{
+						this->fail(string::va("Size mismatch on \"%s\"", current.info.name.c_str()));
+						return;
+					}
+
+					if (current.crc != current.info.crc)
+					{
+						this->fail(string::va("CRC mismatch on \"%s\"", current.info.name.c_str()));
+						return;
+					}
+
+					if (!current.skipped && !current.out.close())
+					{
+						this->fail(string::va("Failed to write \"%s\"", current.info.name.c_str()));
+						return;
+					}
+
+					this->extracted_.emplace_back(std::move(current.info));
+					this->state_ = state::header;
+				}
+			};
+		}
+
+		void archive::add(const std::string& filename, const std::string& data)
+		{
+			this->files_[filename] = data;
+		}
+
+		int probe_compression_level(const std::span<const std::byte> data)
+		{
+			if (data.empty())
+			{
+				return 0;
+			}
+
+			std::vector<std::byte> samples{};
+			auto sample = data;
+
+			if (data.size() > PROBE_SAMPLES * PROBE_SAMPLE_SIZE)
+			{
+				samples.reserve(PROBE_SAMPLES * PROBE_SAMPLE_SIZE);
+
+				const auto step = (data.size() - PROBE_SAMPLE_SIZE) / (PROBE_SAMPLES - 1);
+				for (std::size_t i = 0; i < PROBE_SAMPLES; ++i)
+				{
+					const auto piece = data.subspan(i * step, PROBE_SAMPLE_SIZE);
+					samples.insert(samples.end(), piece.begin(), piece.end());
+				}
+
+				sample = samples;
+			}
+
+			auto length = compressBound(static_cast<uLong>(sample.size()));
+			const auto buffer = std::make_unique<Bytef[]>(length);
+			if (compress2(buffer.get(), &length, reinterpret_cast<const Bytef*>(sample.data()), static_cast<uLong>(sample.size()), Z_BEST_SPEED) != Z_OK)
+			{
+				return Z_BEST_COMPRESSION;
+			}
+
+			// Already compressed data (.iwd, .ff, media) would only get bigger and costs the most time to deflate
+			const auto ratio = length * 100 / sample.size();
+			if (ratio >= PROBE_STORE_RATIO)
+			{
+				return 0;
+			}
+
+			return ratio >= PROBE_FAST_RATIO ? Z_BEST_SPEED : Z_BEST_COMPRESSION;
+		}
+
+		void archive::set_compression_policy(compression_policy policy)
+		{
+			this->compression_policy_ = std::move(policy);
+		}
+
+		void archive::add_file(const std::string& filename, const std::filesystem::path& file)
+		{
+			this->files_[filename] = file;
+		}
+
+		bool archive::add_folder(const std::filesystem::path& folder, const std::string& prefix)
+		{
+			std::error_code ec;
+			for (std::filesystem::recursive_directory_iterator i(folder, ec), end; !ec && i != end; i.increment(ec))
+			{
+				std::error_code file_ec;
+				if (!i->is_regular_file(file_ec))
+				{
+					continue;
+				}
+
+				const auto file = std::filesystem::relative(i->path(), folder, file_ec);
+				if (file_ec)
+				{
+					return false;
+				}
+
+				this->add_file(prefix + file.generic_string(), i->path());
+			}
+
+			return !ec;
+		}
+
+		bool archive::write(const std::string& filename, const std::string& comment)
+		{
+			// Hack to create the directory :3
+			io::write_file(filename, {});
+			io::remove_file(filename);
+
+			auto* zip_file = zipOpen64(filename.c_str(), false);
+			if (!zip_file)
+			{
+				return false;
+			}
+
+			const auto _ = gsl::finally([&zip_file, &comment]() -> void
+			{
+				zipClose(zip_file, comment.empty() ? nullptr : comment.c_str());
+			});
+
+			const auto thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+			const auto max_blocks = thread_count * BLOCKS_PER_THREAD;
+
+			// Entries are only opened once their first block is due, and closed with their last one
+			std::deque<deflate_entry> entries{};
+			std::deque<std::unique_ptr<deflate_block>> blocks{};
+			std::deque<deflate_block*> queue{};
+
+			std::mutex mutex{};
+			std::condition_variable work_available{};
+			std::condition_variable block_done{};
+			auto stop = false;
+
+			const auto worker = [&]
+			{
+				block_deflater deflater{};
+
+				std::unique_lock lock(mutex);
+				while (true)
+				{
+					work_available.wait(lock, [&]
+					{
+						return stop || !queue.empty();
+					});
+
+					if (stop)
+					{
+						break;
+					}
+
+					auto* block = queue.front();
+					queue.pop_front();
+
+					lock.unlock();
+					const auto deflated = deflater.deflate(*block);
+					lock.lock();
+
+					block->failed = !deflated;
+					block->done = true;
+					block_done.notify_all();
+				}
+			};
+
+			std::vector<std::thread> threads{};
+			threads.reserve(thread_count);
+
+			const auto __ = gsl::finally([&]
+			{
+				{
+					std::lock_guard lock(mutex);
+					stop = true;
+				}
+
+				work_available.notify_all();
+				for (auto& thread : threads)
+				{
+					thread.join();
+				}
+			});
+
+			for (std::size_t i = 0; i < thread_count; ++i)
+			{
+				threads.emplace_back(worker);
+			}
+
+			auto next_file = this->files_.begin();
+			std::size_t offset = 0;
+
+			while (true)
+			{
+				while (blocks.size() < max_blocks && next_file != this->files_.end())
+				{
+					if (!offset)
+					{
+						auto& entry = entries.emplace_back(&next_file->first, io::mapped_file{}, std::span<const std::byte>{}, 0u, 0);
+						if (const auto* data = std::get_if<std::string>(&next_file->second))
+						{
+							entry.data = std::as_bytes(std::span(*data));
+						}
+						else
+						{
+							const auto& path = std::get<std::filesystem::path>(next_file->second);
+
+							// Empty files can't be mapped
+							std::error_code ec;
+							if (std::filesystem::file_size(path, ec) || ec)
+							{
+								entry.file = io::mapped_file(path);
+								if (!entry.file.is_open())
+								{
+									return false;
+								}
+
+								entry.data = entry.file.data();
+							}
+						}
+
+						entry.level = this->compression_policy_
+							              ? this->compression_policy_(*entry.name, entry.data)
+							              : probe_compression_level(entry.data);
+					}
+
+					auto& entry = entries.back();
+					const auto size = std::min(entry.data.size() - offset, DEFLATE_BLOCK_SIZE);
+					const auto window = std::min(offset, DEFLATE_WINDOW_SIZE);
+
+					auto block = std::make_unique<deflate_block>();
+					block->entry = &entry;
+					block->dictionary = entry.data.subspan(offset - window, window);
+					block->input = entry.data.subspan(offset, size);
+					block->first = !offset;
+					block->last = offset + size == entry.data.size();
+
+					offset += size;
+					if (block->last)
+					{
+						offset = 0;
+						++next_file;
+					}
+
+					{
+						std::lock_guard lock(mutex);
+						queue.emplace_back(block.get());
+					}
+
+					blocks.emplace_back(std::move(block));
+					work_available.notify_one();
+				}
+
+				if (blocks.empty())
+				{
+					break;
+				}
+
+				{
+					std::unique_lock lock(mutex);
+					block_done.wait(lock, [&]
+					{
+						return blocks.front()->done;
+					});
+				}
+
+				const auto block = std::move(blocks.front());
+				blocks.pop_front();
+
+				if (block->failed || !write_block(zip_file, *block))
+				{
+					return false;
+				}
+
+				if (block->last)
+				{
+					entries.pop_front();
+				}
+			}
+
+			return true;
+		}
+
+		namespace
+		{
+			using unz_handle = std::unique_ptr<void, decltype(&unzClose)>;
+			using unz_opener = std::function<unzFile()>;
+
+			struct file_entry
+			{
+				unz64_file_pos position;
+				std::string name;
+				std::uint64_t size;
+				std::uint64_t compressed_size;
+				std::uint32_t crc;
+				bool encrypted;
+			};
+
+			// Archives with fewer files than this are not worth spinning up threads for
+			constexpr std::size_t MIN_FILES_PER_THREAD = 4;
+
+			unz_handle open_handle(const unz_opener& open, const std::string& filename)
+			{
+				unz_handle file(open(), unzClose);
+				if (!file)
+				{
+					throw std::runtime_error(string::va("Failed to open %s", filename.c_str()));
+				}
+
+				return file;
+			}
+
+			// Walks the central directory once and creates the whole directory tree on the way, so extracting the files
+			// needs no directory syscalls at all. Returns the file entries that pass the filter, in central directory order.
+			// Paths go through make_preferred(), so / becomes \\ on Windows and stays as it is on POSIX
+			std::vector<file_entry> list_files(unzFile file, const std::string& filename, const std::filesystem::path& out_dir, const entry_filter& filter)
+			{
+				unz_global_info64 global_info;
+				if (unzGetGlobalInfo64(file, &global_info) != UNZ_OK)
+				{
+					throw std::runtime_error(string::va("unzGetGlobalInfo failed on %s", filename.c_str()));
+				}
+
+				std::vector<file_entry> files{};
+				files.reserve(static_cast<std::size_t>(global_info.number_entry));
+
+				io::directory_cache directories{};
+
+				for (ZPOS64_T i = 0; i < global_info.number_entry; ++i)
+				{
+					if (i > 0 && unzGoToNextFile(file) != UNZ_OK)
+					{
+						break;
+					}
+
+					// Get info about the current file.
+					unz_file_info64 file_info;
+					char filename_buffer[MAX_PATH]{};
+
+					if (unzGetCurrentFileInfo64(file, &file_info, filename_buffer, sizeof(filename_buffer) - 1,
+					                            nullptr, 0, nullptr, 0) != UNZ_OK)
+					{
+						continue;
+					}
+
+					std::string out_file = filename_buffer;
+					if (out_file.empty())
+					{
+						continue;
+					}
+
+#ifndef _WIN32
+					// Fix for UNIX Systems. Some programs like unzip treat this as a warning
+					std::replace(out_file.begin(), out_file.end(), '\\', '/');
+#endif
+
+					if (filter && !filter(out_file))
+					{
+						continue;
+					}
+
+					if (out_file.back() == '/' || out_file.back() == '\\') // ZIP is not directory-separator-agnostic
+					{
+						auto dir = out_dir / out_file;
+						directories.create(dir.make_preferred());
+						continue;
+					}
+
+					auto path = out_dir / out_file;
+					directories.create_parent(path.make_preferred());
+
+					file_entry entry{};
+					if (unzGetFilePos64(file, &entry.position) != UNZ_OK)
+					{
+						throw std::runtime_error(string::va("Failed to locate \"%s\" in \"%s\"", out_file.c_str(), filename.c_str()));
+					}
+
+					entry.name = std::move(out_file);
+					entry.size = file_info.uncompressed_size;
+					entry.compressed_size = file_info.compressed_size;
+					entry.crc = static_cast<std::uint32_t>(file_info.crc);
+					entry.encrypted = (file_info.flag & 1) != 0;
+					files.emplace_back(std::move(entry));
+				}
+
+				return files;
+			}
+
+			struct entry_data
+			{
+				int method;
+				std::span<const std::byte> data;
+			};
+
+			// Entries of an archive in memory are opened raw and decoded straight out of the buffer. Returns their
+			// compressed data, or nothing if the entry has been opened for unzReadCurrentFile instead
+			std::optional<entry_data> open_entry(unzFile file, const std::span<const std::byte> archive, const file_entry& entry, const std::string& filename)
+			{
+				const auto open = [&]
+				{
+					if (unzOpenCurrentFile(file) != UNZ_OK)
+					{
+						throw std::runtime_error(string::va("Failed to read file \"%s\" from \"%s\"", entry.name.c_str(), filename.c_str()));
+					}
+
+					return std::optional<entry_data>{};
+				};
+
+				if (unzGoToFilePos64(file, &entry.position) != UNZ_OK)
+				{
+					throw std::runtime_error(string::va("Failed to read file \"%s\" from \"%s\"", entry.name.c_str(), filename.c_str()));
+				}
+
+				if (archive.empty() || entry.encrypted)
+				{
+					return open();
+				}
+
+				entry_data result{};
+				int level = 0;
+				if (unzOpenCurrentFile2(file, &result.method, &level, 1) != UNZ_OK)
+				{
+					return open();
+				}
+
+				const auto offset = unzGetCurrentFileZStreamPos64(file);
+				unzCloseCurrentFile(file);
+
+				if ((result.method != 0 && result.method != Z_DEFLATED) || offset > archive.size() || entry.compressed_size > archive.size() - offset)
+				{
+					return open();
+				}
+
+				result.data = archive.subspan(static_cast<std::size_t>(offset), static_cast<std::size_t>(entry.compressed_size));
+				return {result};
+			}
+
+			void extract_file(unzFile file, const std::span<const std::byte> archive, const file_entry& entry, const std::string& filename,
+			                  const std::filesystem::path& out_dir, char* read_buffer)
+			{
+				const auto in_place = open_entry(file, archive, entry, filename);
+
+				auto path = out_dir / entry.name;
+				auto out = open_output(path.make_preferred(), entry.size);
+				if (!out.is_open())
+				{
+					unzCloseCurrentFile(file);
+					throw std::runtime_error(string::va("Failed to open \"%s\" for writing", entry.name.c_str()));
+				}
+
+				std::uint32_t crc = 0;
+				if (in_place)
+				{
+					std::uint64_t size = 0;
+					bool write_failed = false;
+					const auto write = [&](const std::uint8_t* data, const std::size_t length)
+					{
+						crc = crc32::update(crc, data, length);
+						size += length;
+						write_failed = !out.write(data, length);
+						return !write_failed;
+					};
+
+					const auto result = in_place->method == Z_DEFLATED
+						                    ? inflate::inflate_raw(in_place->data, write)
+						                    : write(reinterpret_cast<const std::uint8_t*>(in_place->data.data()), in_place->data.size());
+
+					if (write_failed)
+					{
+						throw std::runtime_error(string::va("Failed to write \"%s\"", entry.name.c_str()));
+					}
+
+					if (!result)
+					{
+						throw std::runtime_error(string::va("Error while reading \"%s\" from the archive", entry.name.c_str()));
+					}
+
+					// minizip checks nothing for an entry opened raw
+					if (crc != entry.crc || size != entry.size)
+					{
+						throw std::runtime_error(string::va("CRC mismatch on \"%s\" in \"%s\"", entry.name.c_str(), filename.c_str()));
+					}
+
+					if (!out.close())
+					{
+						throw std::runtime_error(string::va("Failed to extract \"%s\" from \"%s\"", entry.name.c_str(), filename.c_str()));
+					}
+
+					return;
+				}
+
+				while (true)
+				{
+					const auto read_bytes = unzReadCurrentFile(file, read_buffer, READ_BUFFER_SIZE);
+					if (read_bytes < 0)
+					{
+						unzCloseCurrentFile(file);
+						throw std::runtime_error(string::va("Error while reading \"%s\" from the archive", entry.name.c_str()));
+					}
+
+					if (!read_bytes)
+					{
+						break;
+					}
+
+					if (!out.write(read_buffer, static_cast<std::size_t>(read_bytes)))
+					{
+						unzCloseCurrentFile(file);
+						throw std::runtime_error(string::va("Failed to write \"%s\"", entry.name.c_str()));
+					}
+
+					crc = crc32::update(crc, read_buffer, static_cast<std::size_t>(read_bytes));
+				}
+
+				// Closing is what makes minizip compare the CRC of a fully read entry
+				const auto close_result = unzCloseCurrentFile(file);
+				if (close_result == UNZ_CRCERROR || crc != entry.crc)
+				{
+					throw std::runtime_error(string::va("CRC mismatch on \"%s\" in \"%s\"", entry.name.c_str(), filename.c_str()));
+				}
+
+				if (close_result != UNZ_OK || !out.close())
+				{
+					throw std::runtime_error(string::va("Failed to extract \"%s\" from \"%s\"", entry.name.c_str(), filename.c_str()));
+				}
+			}
+
+			// Every worker has its own handle, minizip handles can't be shared between threads.
+			// Workers take the largest entry left, so a single huge file starts first instead of becoming the tail.
+			// archive is empty unless the whole archive is in memory
+			void extract_all(const unz_opener& open, const std::span<const std::byte> archive, const std::string& filename,
+			                 const std::filesystem::path& out_dir, const entry_filter& filter)
+			{
+				auto files = list_files(open_handle(open, filename).get(), filename, out_dir, filter);
+
+				std::stable_sort(files.begin(), files.end(), [](const file_entry& a, const file_entry& b)
+				{
+					return a.size > b.size;
+				});
+
+				std::atomic_size_t next_file = 0;
+				std::atomic_bool failed = false;
+				std::exception_ptr error{};
+				std::mutex error_mutex{};
+
+				const auto worker = [&]
+				{
+					try
+					{
+						const auto file = open_handle(open, filename);
+						const auto read_buffer = std::make_unique<char[]>(READ_BUFFER_SIZE);
+
+						while (!failed)
+						{
+							const auto index = next_file++;
+							if (index >= files.size())
+							{
+								break;
+							}
+
+							extract_file(file.get(), archive, files[index], filename, out_dir, read_buffer.get());
+						}
+					}
+					catch (...)
+					{
+						std::lock_guard _(error_mutex);
+						if (!failed.exchange(true))
+						{
+							error = std::current_exception();
+						}
+					}
+				};
+
+				const auto thread_count = std::clamp<std::size_t>(files.size() / MIN_FILES_PER_THREAD, 1, std::max(std::thread::hardware_concurrency(), 1u));
+
+				std::vector<std::thread> threads{};
+				threads.reserve(thread_count - 1);
+
+				for (std::size_t i = 1; i < thread_count; ++i)
+				{
+					threads.emplace_back(worker);
+				}
+
+				worker();
+
+				for (auto& thread : threads)
+				{
+					thread.join();
+				}
+
+				if (error)
+				{
+					std::rethrow_exception(error);
+				}
+			}
+		}
+
+		void archive::decompress(const std::string& filename, const std::filesystem::path& out_dir, const entry_filter& filter)
+		{
+			// Reading through a mapping saves a syscall for every block minizip reads
+			const io::mapped_file mapped_file(filename);
+			if (mapped_file.is_open())
+			{
+				decompress(mapped_file.data(), out_dir, filter);
+				return;
+			}
+
+			extract_all([&filename]
+			{
+				return unzOpen(filename.c_str());
+			}, {}, filename, out_dir, filter);
+		}
+
+		void archive::decompress(std::span<const std::byte> data, const std::filesystem::path& out_dir, const entry_filter& filter)
+		{
+			// Every handle gets its own cursor over the same bytes
+			extract_all([data]
+			{
+				auto view = data;
+				return open_memory(view);
+			}, data, "<memory>", out_dir, filter);
+		}
+
+		void archive::decompress(const io::mapped_file& file, const std::filesystem::path& out_dir, const entry_filter& filter)
+		{
+			decompress(file.data(), out_dir, filter);
+		}
+
+		std::optional<directory_info> find_central_directory(const std::span<const std::byte> tail, const std::uint64_t archive_size)
+		{
+			const auto* data = reinterpret_cast<const std::uint8_t*>(tail.data());
+			if (tail.size() < END_OF_CENTRAL_DIRECTORY_SIZE || tail.size() > archive_size)
+			{
+				return {};
+			}
+
+			// The record ends with a variable length comment, search backwards
+			const auto tail_offset = archive_size - tail.size();
+			for (auto i = tail.size() - END_OF_CENTRAL_DIRECTORY_SIZE + 1; i-- > 0;)
+			{
+				const auto* record = data + i;
+				if (read_32(record) != END_OF_CENTRAL_DIRECTORY_SIGNATURE
+					|| i + END_OF_CENTRAL_DIRECTORY_SIZE + read_16(record + 20) != tail.size())
+				{
+					continue;
+				}
+
+				directory_info info{};
+				info.entries = read_16(record + 10);
+				info.size = read_32(record + 12);
+				info.offset = read_32(record + 16);
+
+				if (info.entries == 0xFFFF || info.size == ZIP64_MARKER || info.offset == ZIP64_MARKER)
+				{
+					if (i < ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIZE)
+					{
+						return {};
+					}
+
+					const auto* locator = record - ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIZE;
+					const auto zip64_offset = read_64(locator + 8);
+					if (read_32(locator) != ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIGNATURE || zip64_offset < tail_offset
+						|| zip64_offset - tail_offset + ZIP64_END_OF_CENTRAL_DIRECTORY_SIZE > tail.size())
+					{
+						return {};
+					}
+
+					const auto* zip64_record = data + (zip64_offset - tail_offset);
+					if (read_32(zip64_record) != ZIP64_END_OF_CENTRAL_DIRECTORY_SIGNATURE)
+					{
+						return {};
+					}
+
+					info.entries = read_64(zip64_record + 32);
+					info.size = read_64(zip64_record + 40);
+					info.offset = read_64(zip64_record + 48);
+				}
+
+				if (info.offset > archive_size || info.size > archive_size - info.offset)
+				{
+					return {};
+				}
+
+				return {info};
+			}
+
+			return {};
+		}
+
+		std::optional<std::vector<entry_info>> read_central_directory(const std::span<const std::byte> data)
+		{
+			const auto* begin = reinterpret_cast<const std::uint8_t*>(data.data());
+			auto size = data.size();
+
+			auto entries = parse_central_directory(begin, size);
+			if (!entries || size)
+			{
+				return {};
+			}
+
+			return entries;
+		}
+
+		bool extract_entry(const entry_info& entry, const std::span<const std::byte> record, const std::filesystem::path& out_dir, std::string* error)
+		{
+			record_parser parser(out_dir, entry.local_header_offset);
+			if (parser.parse(reinterpret_cast<const std::uint8_t*>(record.data()), record.size()) && parser.verify_entry(entry))
+			{
+				return true;
+			}
+
+			if (error)
+			{
+				*error = parser.get_error();
+			}
+
+			return false;
+		}
+
+		bool is_directory(const entry_info& entry)
+		{
+			return is_directory_entry(entry.name);
+		}
+
+		void set_direct_io_threshold(const std::uint64_t size)
+		{
+			direct_io_threshold = size;
+		}
+
+		class stream_extractor::parser : public record_parser
+		{
+		public:
+			using record_parser::record_parser;
+		};
+
+		stream_extractor::stream_extractor(std::filesystem::path out_dir, entry_filter filter)
+			: parser_(std::make_unique<parser>(std::move(out_dir), 0, std::move(filter)))
+		{
+			this->worker_ = std::thread([this]
+			{
+				this->run();
+			});
+		}
+
+		stream_extractor::~stream_extractor()
+		{
+			{
+				std::lock_guard _(this->mutex_);
+				this->finished_ = true;
+				this->failed_ = true;
+			}
+
+			this->cv_.notify_all();
+
+			if (this->worker_.joinable())
+			{
+				this->worker_.join();
+			}
+		}
+
+		void stream_extractor::feed(const char* data, const std::size_t size)
+		{
+			if (!size)
+			{
+				return;
+			}
+
+			std::unique_lock lock(this->mutex_);
+			this->cv_.wait(lock, [this]
+			{
+				return this->failed_ || this->queued_bytes_ < MAX_QUEUED_BYTES;
+			});
+
+			// There is no point in queueing more once the archive can't be streamed
+			if (this->failed_ || this->finished_)
+			{
+				return;
+			}
+
+			this->queue_.emplace_back(data, size);
+			this->queued_bytes_ += size;
+
+			lock.unlock();
+			this->cv_.notify_all();
+		}
+
+		bool stream_extractor::finish()
+		{
+			{
+				std::lock_guard _(this->mutex_);
+				this->finished_ = true;
+			}
+
+			this->cv_.notify_all();
+
+			if (this->worker_.joinable())
+			{
+				this->worker_.join();
+			}
+
+			return this->parser_->verify();
+		}
+
+		const std::string& stream_extractor::get_error() const
+		{
+			return this->parser_->get_error();
+		}
+
+		std::size_t stream_extractor::get_entry_count() const
+		{
+			return this->parser_->get_entry_count();
+		}
+
+		void stream_extractor::run()
+		{
+			while (true)
+			{
+				std::string chunk{};
+
+				{
+					std::unique_lock lock(this->mutex_);
+					this->cv_.wait(lock, [this]
+					{
+						return this->finished_ || !this->queue_.empty();
+					});
+
+					if (this->queue_.empty() || this->failed_)
+					{
+						return;
+					}
+
+					chunk = std::move(this->queue_.front());
+					this->queue_.pop_front();
+					this->queued_bytes_ -= chunk.size();
+				}
+
+				this->cv_.notify_all();
+
+				if (!this->parser_->parse(reinterpret_cast<const std::uint8_t*>(chunk.data()), chunk.size()))
+				{
+					std::lock_guard _(this->mutex_);
+					this->failed_ = true;
+					this->queue_.clear();
+					this->queued_bytes_ = 0;
+					this->cv_.notify_all();
+					return;
+				}
+			}
 		}
 	}
 }
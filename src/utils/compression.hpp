@@ -1,8 +1,22 @@
 #pragma once
 
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "mapped_file.hpp"
 
 #define CHUNK 16384u
 
@@ -16,16 +30,121 @@ namespace utils::compression
 
 	namespace zip
 	{
+		struct entry_info
+		{
+			std::string name;
+			std::uint16_t flags = 0;
+			std::uint16_t method = 0;
+			std::uint32_t crc = 0;
+			std::uint64_t compressed_size = 0;
+			std::uint64_t uncompressed_size = 0;
+			std::uint64_t local_header_offset = 0;
+		};
+
+		// Where the central directory sits in the archive
+		struct directory_info
+		{
+			std::uint64_t offset = 0;
+			std::uint64_t size = 0;
+			std::uint64_t entries = 0;
+		};
+
+		// The end of central directory record is at most this far from the end of the archive
+		constexpr std::size_t MAX_END_OF_CENTRAL_DIRECTORY_SIZE = 22 + 0xFFFF + 20;
+
+		// tail holds the last bytes of an archive of archive_size bytes.
+		// ZIP64 archives need the ZIP64 end of central directory record to be part of tail
+		std::optional<directory_info> find_central_directory(std::span<const std::byte> tail, std::uint64_t archive_size);
+		std::optional<std::vector<entry_info>> read_central_directory(std::span<const std::byte> data);
+
+		// Extracts a single entry from its local record, that is everything from its local header up to the next record
+		bool extract_entry(const entry_info& entry, std::span<const std::byte> record, const std::filesystem::path& out_dir, std::string* error = nullptr);
+
+		bool is_directory(const entry_info& entry);
+
+		// Decides which entries get extracted from the entry name as stored in the archive, directories end in /.
+		// Everything else is never inflated or written
+		using entry_filter = std::function<bool(const std::string& name)>;
+
+		// Extracted files of at least this size bypass the page cache. Meant for assets far bigger than
+		// what is worth caching, 0 (the default) turns it off
+		void set_direct_io_threshold(std::uint64_t size);
+
+		// Picks the zlib level an entry is written with from its name and data, 0 stores it
+		using compression_policy = std::function<int(const std::string& name, std::span<const std::byte> data)>;
+
+		// Deflates a few samples of data at the fastest level. Data that barely shrinks that way is stored
+		// or deflated at the fastest level, everything else at the best one
+		int probe_compression_level(std::span<const std::byte> data);
+
 		class archive
 		{
 		public:
 			void add(const std::string& filename, const std::string& data);
+
+			// The file is only read while the archive is written, its data is never held in memory as a whole
+			void add_file(const std::string& filename, const std::filesystem::path& file);
+
+			// Adds every file below folder, named by its path relative to folder
+			[[nodiscard]] bool add_folder(const std::filesystem::path& folder, const std::string& prefix = {});
+
+			// Defaults to probe_compression_level
+			void set_compression_policy(compression_policy policy);
+
+			// Entries are deflated in blocks on one thread per core and written in order, only a few blocks
+			// per thread are held in memory. Entries and archives beyond 4 GB are written as ZIP64
 			[[nodiscard]] bool write(const std::string& filename, const std::string& comment = {});
 
-			static void decompress(const std::string& filename, const std::filesystem::path& out_dir);
+			// Entries are extracted on one thread per core, each with its own minizip handle
+			static void decompress(const std::string& filename, const std::filesystem::path& out_dir, const entry_filter& filter = {});
+
+			// The archive is read in place, several threads may decompress from the same data at once
+			static void decompress(std::span<const std::byte> data, const std::filesystem::path& out_dir, const entry_filter& filter = {});
+			static void decompress(const io::mapped_file& file, const std::filesystem::path& out_dir, const entry_filter& filter = {});
+
+		private:
+			// Either the data itself or the file to read it from
+			std::map<std::string, std::variant<std::string, std::filesystem::path>> files_;
+			compression_policy compression_policy_;
+		};
+
+		// Extracts an archive while it is still being downloaded. Entries are parsed from their local headers
+		// as the bytes come in and are inflated on a worker thread. Once the central directory has arrived,
+		// finish() checks every extracted entry against it. Entries the filter rejects are passed over
+		class stream_extractor
+		{
+		public:
+			explicit stream_extractor(std::filesystem::path out_dir, entry_filter filter = {});
+			~stream_extractor();
+
+			stream_extractor(stream_extractor&&) = delete;
+			stream_extractor(const stream_extractor&) = delete;
+			stream_extractor& operator=(stream_extractor&&) = delete;
+			stream_extractor& operator=(const stream_extractor&) = delete;
+
+			// Queues the next bytes of the archive. Blocks while the worker is too far behind
+			void feed(const char* data, std::size_t size);
+
+			// Returns false if the archive could not be streamed. Whatever was extracted must then be discarded
+			[[nodiscard]] bool finish();
+
+			[[nodiscard]] const std::string& get_error() const;
+			[[nodiscard]] std::size_t get_entry_count() const;
 
 		private:
-			std::unordered_map<std::string, std::string> files_;
+			class parser;
+
+			std::unique_ptr<parser> parser_;
+			std::thread worker_;
+
+			std::mutex mutex_;
+			std::condition_variable cv_;
+			std::deque<std::string> queue_;
+			std::size_t queued_bytes_ = 0;
+			bool finished_ = false;
+			bool failed_ = false;
+
+			void run();
 		};
 	}
 };
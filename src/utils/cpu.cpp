@@ -0,0 +1,160 @@
+#include <std_include.hpp>
+
+#include "cpu.hpp"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define CPU_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define CPU_ARM64
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+namespace utils::cpu
+{
+	namespace
+	{
+#ifdef CPU_X86
+		struct x86_features
+		{
+			bool pclmul = false;
+			bool ssse3 = false;
+			bool sse41 = false;
+			bool avx2 = false;
+			bool bmi2 = false;
+			bool sha = false;
+		};
+
+		void cpuid(const unsigned int leaf, const unsigned int subleaf, unsigned int registers[4])
+		{
+#ifdef _MSC_VER
+			int info[4]{};
+			__cpuidex(info, static_cast<int>(leaf), static_cast<int>(subleaf));
+			for (auto i = 0; i < 4; ++i)
+			{
+				registers[i] = static_cast<unsigned int>(info[i]);
+			}
+#else
+			registers[0] = registers[1] = registers[2] = registers[3] = 0;
+			__get_cpuid_count(leaf, subleaf, &registers[0], &registers[1], &registers[2], &registers[3]);
+#endif
+		}
+
+		bool os_saves_avx_state()
+		{
+#ifdef _MSC_VER
+			return (_xgetbv(0) & 6) == 6;
+#else
+			unsigned int eax, edx;
+			__asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+			return (eax & 6) == 6;
+#endif
+		}
+
+		x86_features detect_x86()
+		{
+			x86_features features{};
+
+			unsigned int registers[4]{};
+			cpuid(0, 0, registers);
+			const auto max_leaf = registers[0];
+
+			cpuid(1, 0, registers);
+			features.pclmul = registers[2] & (1u << 1);
+			features.ssse3 = registers[2] & (1u << 9);
+			features.sse41 = registers[2] & (1u << 19);
+
+			const auto avx = (registers[2] & (1u << 27)) && (registers[2] & (1u << 28)) && os_saves_avx_state();
+
+			if (max_leaf >= 7)
+			{
+				cpuid(7, 0, registers);
+				features.avx2 = avx && (registers[1] & (1u << 5));
+				features.bmi2 = registers[1] & (1u << 8);
+				features.sha = registers[1] & (1u << 29);
+			}
+
+			return features;
+		}
+
+		const x86_features& get_x86()
+		{
+			static const auto features = detect_x86();
+			return features;
+		}
+#endif
+	}
+
+	bool has_pclmul()
+	{
+#ifdef CPU_X86
+		return get_x86().pclmul && get_x86().sse41;
+#else
+		return false;
+#endif
+	}
+
+	bool has_sha()
+	{
+#ifdef CPU_X86
+		return get_x86().sha && get_x86().ssse3 && get_x86().sse41;
+#else
+		return false;
+#endif
+	}
+
+	bool has_avx2()
+	{
+#ifdef CPU_X86
+		return get_x86().avx2;
+#else
+		return false;
+#endif
+	}
+
+	bool has_bmi2()
+	{
+#ifdef CPU_X86
+		return get_x86().bmi2;
+#else
+		return false;
+#endif
+	}
+
+	bool has_arm_crc32()
+	{
+#if !defined(CPU_ARM64)
+		return false;
+#elif defined(__ARM_FEATURE_CRC32) || defined(__APPLE__)
+		return true;
+#elif defined(_WIN32)
+		return IsProcessorFeaturePresent(PF_ARM_V8_CRC32_INSTRUCTIONS_AVAILABLE) != FALSE;
+#elif defined(__linux__)
+		return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+		return false;
+#endif
+	}
+
+	bool has_arm_sha2()
+	{
+#if !defined(CPU_ARM64)
+		return false;
+#elif defined(__ARM_FEATURE_SHA2) || defined(__APPLE__)
+		return true;
+#elif defined(_WIN32)
+		return IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE) != FALSE;
+#elif defined(__linux__)
+		return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#else
+		return false;
+#endif
+	}
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+namespace utils::cpu
+{
+	// Instruction set extensions the code has specialized paths for. Always false on other architectures
+	bool has_pclmul(); // x86 PCLMULQDQ and SSE4.1
+	bool has_sha(); // x86 SHA extensions, SSSE3 and SSE4.1
+	bool has_avx2();
+	bool has_bmi2();
+	bool has_arm_crc32();
+	bool has_arm_sha2();
+}
@@ -0,0 +1,231 @@
+#include <std_include.hpp>
+
+#include "cpu.hpp"
+#include "crc32.hpp"
+
+#include <zlib.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define CRC32_X86
+#include <immintrin.h>
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define CRC32_ARM64
+#include <arm_acle.h>
+#endif
+
+#if defined(__clang__) || defined(__GNUC__)
+#define CRC32_TARGET(features) __attribute__((target(features)))
+#else
+#define CRC32_TARGET(features)
+#endif
+
+namespace utils::crc32
+{
+	namespace
+	{
+		using kernel = std::uint32_t(*)(std::uint32_t crc, const std::uint8_t* data, std::size_t size);
+
+		// zlib takes the size as uInt
+		std::uint32_t update_zlib(std::uint32_t crc, const std::uint8_t* data, std::size_t size)
+		{
+			while (size > 0)
+			{
+				const auto chunk = std::min<std::size_t>(size, std::numeric_limits<uInt>::max());
+				crc = static_cast<std::uint32_t>(::crc32(crc, data, static_cast<uInt>(chunk)));
+				data += chunk;
+				size -= chunk;
+			}
+
+			return crc;
+		}
+
+#ifdef CRC32_X86
+		// Folding with carry-less multiplication, see Intel's "Fast CRC Computation for Generic Polynomials
+		// Using PCLMULQDQ Instruction". Works on the inverted CRC and needs at least 64 bytes, a multiple of 16
+		CRC32_TARGET("pclmul,sse4.1")
+		std::uint32_t fold_pclmul(const std::uint32_t crc, const std::uint8_t* data, std::size_t size)
+		{
+			alignas(16) static constexpr std::uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+			alignas(16) static constexpr std::uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+			alignas(16) static constexpr std::uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+			alignas(16) static constexpr std::uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+			auto x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x00));
+			auto x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x10));
+			auto x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x20));
+			auto x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x30));
+
+			x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+
+			auto x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+
+			data += 64;
+			size -= 64;
+
+			// Fold 512 bits at a time
+			while (size >= 64)
+			{
+				const auto x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+				const auto x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+				const auto x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+				const auto x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+				x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+				x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+				x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+				x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+				x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x00)));
+				x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x10)));
+				x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x20)));
+				x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x30)));
+
+				data += 64;
+				size -= 64;
+			}
+
+			// Fold into 128 bits
+			x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+
+			for (const auto next : {x2, x3, x4})
+			{
+				const auto x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+				x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+				x1 = _mm_xor_si128(_mm_xor_si128(x1, next), x5);
+			}
+
+			while (size >= 16)
+			{
+				const auto x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+				x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+				x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data))), x5);
+
+				data += 16;
+				size -= 16;
+			}
+
+			// Fold 128 bits into 64
+			x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+			x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+			x1 = _mm_srli_si128(x1, 8);
+			x1 = _mm_xor_si128(x1, x2);
+
+			x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+
+			x2 = _mm_srli_si128(x1, 4);
+			x1 = _mm_and_si128(x1, x3);
+			x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+			x1 = _mm_xor_si128(x1, x2);
+
+			// Barrett reduction to 32 bits
+			x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+
+			x2 = _mm_and_si128(x1, x3);
+			x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+			x2 = _mm_and_si128(x2, x3);
+			x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+			x1 = _mm_xor_si128(x1, x2);
+
+			return static_cast<std::uint32_t>(_mm_extract_epi32(x1, 1));
+		}
+
+		std::uint32_t update_pclmul(const std::uint32_t crc, const std::uint8_t* data, const std::size_t size)
+		{
+			if (size < 64)
+			{
+				return update_zlib(crc, data, size);
+			}
+
+			const auto folded = size & ~static_cast<std::size_t>(15);
+			const auto result = ~fold_pclmul(~crc, data, folded);
+			return update_zlib(result, data + folded, size - folded);
+		}
+#endif
+
+#ifdef CRC32_ARM64
+#if defined(__clang__)
+		CRC32_TARGET("crc")
+#elif defined(__GNUC__)
+		CRC32_TARGET("+crc")
+#endif
+		std::uint32_t update_arm64(std::uint32_t crc, const std::uint8_t* data, std::size_t size)
+		{
+			crc = ~crc;
+
+			while (size && (reinterpret_cast<std::uintptr_t>(data) & 7))
+			{
+				crc = __crc32b(crc, *data++);
+				--size;
+			}
+
+			while (size >= 8)
+			{
+				std::uint64_t value;
+				std::memcpy(&value, data, sizeof(value));
+				crc = __crc32d(crc, value);
+
+				data += 8;
+				size -= 8;
+			}
+
+			while (size--)
+			{
+				crc = __crc32b(crc, *data++);
+			}
+
+			return ~crc;
+		}
+#endif
+
+		struct implementation
+		{
+			kernel update;
+			const char* name;
+		};
+
+		implementation select_implementation()
+		{
+#ifdef CRC32_X86
+			if (cpu::has_pclmul())
+			{
+				return {update_pclmul, "pclmul"};
+			}
+#endif
+
+#ifdef CRC32_ARM64
+			if (cpu::has_arm_crc32())
+			{
+				return {update_arm64, "armv8-crc"};
+			}
+#endif
+
+			return {update_zlib, "zlib"};
+		}
+
+		const implementation& get_selected()
+		{
+			static const auto selected = select_implementation();
+			return selected;
+		}
+	}
+
+	std::uint32_t update(const std::uint32_t crc, const void* data, const std::size_t size)
+	{
+		return get_selected().update(crc, static_cast<const std::uint8_t*>(data), size);
+	}
+
+	std::uint32_t update(const std::uint32_t crc, const std::span<const std::byte> data)
+	{
+		return update(crc, data.data(), data.size());
+	}
+
+	std::uint32_t compute(const std::span<const std::byte> data)
+	{
+		return update(0, data);
+	}
+
+	const char* get_implementation()
+	{
+		return get_selected().name;
+	}
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace utils::crc32
+{
+	// CRC-32 as used by ZIP and gzip. Uses PCLMULQDQ or the ARMv8 CRC instructions when the CPU has them
+	std::uint32_t update(std::uint32_t crc, const void* data, std::size_t size);
+	std::uint32_t update(std::uint32_t crc, std::span<const std::byte> data);
+	std::uint32_t compute(std::span<const std::byte> data);
+
+	// Name of the implementation picked for this CPU
+	const char* get_implementation();
+}
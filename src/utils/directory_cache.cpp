@@ -0,0 +1,42 @@
+#include <std_include.hpp>
+
+#include "directory_cache.hpp"
+
+namespace utils::io
+{
+	bool directory_cache::create(const std::filesystem::path& directory)
+	{
+		if (directory.empty() || this->created_.contains(directory.native()))
+		{
+			return true;
+		}
+
+		// "dir/" names the same directory as "dir"
+		const auto parent = directory.parent_path();
+		if (!directory.has_filename() && parent != directory)
+		{
+			return this->create(parent);
+		}
+
+		if (parent != directory && !this->create(parent))
+		{
+			return false;
+		}
+
+		// All parents exist by now, so a single mkdir does it. It is not an error if the directory is already there
+		std::error_code ec;
+		std::filesystem::create_directory(directory, ec);
+		if (ec)
+		{
+			return false;
+		}
+
+		this->created_.insert(directory.native());
+		return true;
+	}
+
+	bool directory_cache::create_parent(const std::filesystem::path& file)
+	{
+		return this->create(file.parent_path());
+	}
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <filesystem>
+#include <unordered_set>
+
+namespace utils::io
+{
+	// Creates directory trees while remembering every directory that is known to exist.
+	// Each directory costs at most one mkdir, no matter how many files end up in it. Not thread safe
+	class directory_cache
+	{
+	public:
+		// Creates the directory and any missing parents
+		bool create(const std::filesystem::path& directory);
+
+		// Creates the directory the file goes into
+		bool create_parent(const std::filesystem::path& file);
+
+	private:
+		std::unordered_set<std::filesystem::path::string_type> created_;
+	};
+}
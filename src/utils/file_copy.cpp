@@ -0,0 +1,357 @@
+#include <std_include.hpp>
+
+#include "file_copy.hpp"
+#include "directory_cache.hpp"
+#include "mapped_file.hpp"
+
+#ifdef __APPLE__
+#include <copyfile.h>
+#elif !defined(_WIN32)
+#include <cerrno>
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+namespace utils::io
+{
+	namespace
+	{
+		// Copying is mostly waiting on the disk, a single file per thread would not be worth a thread
+		constexpr std::size_t MIN_FILES_PER_THREAD = 4;
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+		constexpr std::size_t COPY_BUFFER_SIZE = 1024 * 1024;
+
+		std::error_code last_error()
+		{
+			return {errno, std::generic_category()};
+		}
+
+		bool copy_data(const int in, const int out, const std::uint64_t size, std::error_code& ec)
+		{
+#ifdef FICLONE
+			// Shares the extents, no data is copied at all
+			if (::ioctl(out, FICLONE, in) == 0)
+			{
+				return true;
+			}
+#endif
+
+#ifdef __linux__
+			std::uint64_t copied = 0;
+			while (copied < size)
+			{
+				const auto result = ::copy_file_range(in, nullptr, out, nullptr, static_cast<std::size_t>(size - copied), 0);
+				if (result > 0)
+				{
+					copied += static_cast<std::uint64_t>(result);
+					continue;
+				}
+
+				// The file got shorter while it was copied
+				if (!result)
+				{
+					return true;
+				}
+
+				if (errno == EINTR)
+				{
+					continue;
+				}
+
+				// Older kernels and some filesystems can't do it, that is only known after the first call
+				if (copied || (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP))
+				{
+					ec = last_error();
+					return false;
+				}
+
+				break;
+			}
+
+			if (copied >= size)
+			{
+				return true;
+			}
+#else
+			(void)size;
+#endif
+
+			const auto buffer = std::make_unique<char[]>(COPY_BUFFER_SIZE);
+			while (true)
+			{
+				const auto read_bytes = ::read(in, buffer.get(), COPY_BUFFER_SIZE);
+				if (read_bytes < 0)
+				{
+					if (errno == EINTR)
+					{
+						continue;
+					}
+
+					ec = last_error();
+					return false;
+				}
+
+				if (!read_bytes)
+				{
+					return true;
+				}
+
+				for (ssize_t written = 0; written < read_bytes;)
+				{
+					const auto result = ::write(out, buffer.get() + written, static_cast<std::size_t>(read_bytes - written));
+					if (result < 0 && errno != EINTR)
+					{
+						ec = last_error();
+						return false;
+					}
+
+					written += std::max<ssize_t>(result, 0);
+				}
+			}
+		}
+
+		bool copy_to(const std::filesystem::path& src, const std::filesystem::path& target, std::error_code& ec)
+		{
+			const auto in = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+			if (in < 0)
+			{
+				ec = last_error();
+				return false;
+			}
+
+			const auto _ = gsl::finally([in]
+			{
+				::close(in);
+			});
+
+			struct stat info{};
+			if (::fstat(in, &info) != 0)
+			{
+				ec = last_error();
+				return false;
+			}
+
+			const auto out = ::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, info.st_mode & 0777);
+			if (out < 0)
+			{
+				ec = last_error();
+				return false;
+			}
+
+			const auto copied = copy_data(in, out, static_cast<std::uint64_t>(info.st_size), ec);
+
+			// Delayed write errors only show up here
+			if (::close(out) != 0 && copied)
+			{
+				ec = last_error();
+				return false;
+			}
+
+			return copied;
+		}
+#endif
+
+		bool transfer(const std::filesystem::path& src, const std::filesystem::path& target, const bool move, std::error_code& ec)
+		{
+			if (move)
+			{
+				std::filesystem::rename(src, target, ec);
+				if (ec != std::errc::cross_device_link)
+				{
+					return !ec;
+				}
+
+				ec.clear();
+			}
+
+			if (!io::copy_file(src, target, ec))
+			{
+				return false;
+			}
+
+			if (move)
+			{
+				std::error_code remove_ec;
+				std::filesystem::remove(src, remove_ec);
+			}
+
+			return true;
+		}
+	}
+
+	bool copy_file(const std::filesystem::path& src, const std::filesystem::path& target, std::error_code& ec)
+	{
+		// Written next to the target first, so nobody ever sees half of it
+		auto temp = target;
+		temp += ".tmp";
+
+#ifdef _WIN32
+		if (!CopyFileExW(src.c_str(), temp.c_str(), nullptr, nullptr, nullptr, 0))
+		{
+			ec = {static_cast<int>(GetLastError()), std::system_category()};
+			return false;
+		}
+#elif defined(__APPLE__)
+		// Clones when both are on the same APFS volume, copies otherwise
+		if (::copyfile(src.c_str(), temp.c_str(), nullptr, COPYFILE_ALL | COPYFILE_CLONE) != 0)
+		{
+			ec = {errno, std::generic_category()};
+			std::error_code remove_ec;
+			std::filesystem::remove(temp, remove_ec);
+			return false;
+		}
+#else
+		if (!copy_to(src, temp, ec))
+		{
+			std::error_code remove_ec;
+			std::filesystem::remove(temp, remove_ec);
+			return false;
+		}
+#endif
+
+		std::filesystem::rename(temp, target, ec);
+		if (ec)
+		{
+			std::error_code remove_ec;
+			std::filesystem::remove(temp, remove_ec);
+			return false;
+		}
+
+		return true;
+	}
+
+	bool files_match(const std::filesystem::path& a, const std::filesystem::path& b)
+	{
+		std::error_code ec;
+		const auto size = std::filesystem::file_size(a, ec);
+		if (ec || std::filesystem::file_size(b, ec) != size || ec)
+		{
+			return false;
+		}
+
+		if (!size)
+		{
+			return true;
+		}
+
+		// Comparing the bytes is as cheap as hashing both files, and exact
+		const mapped_file file_a(a);
+		const mapped_file file_b(b);
+		if (!file_a.is_open() || !file_b.is_open() || file_a.data().size() != file_b.data().size())
+		{
+			return false;
+		}
+
+		return std::memcmp(file_a.data().data(), file_b.data().data(), file_a.data().size()) == 0;
+	}
+
+	copy_result copy_folder(const std::filesystem::path& src, const std::filesystem::path& target, const copy_options& options)
+	{
+		copy_result result{};
+
+		// The tree is walked once up front, the workers then only touch files
+		std::vector<std::filesystem::path> files{};
+		directory_cache directories{};
+
+		std::error_code ec;
+		for (std::filesystem::recursive_directory_iterator i(src, ec), end; !ec && i != end; i.increment(ec))
+		{
+			std::error_code file_ec;
+			auto file = std::filesystem::relative(i->path(), src, file_ec);
+			if (file_ec)
+			{
+				result.errors.emplace_back(i->path(), file_ec);
+				continue;
+			}
+
+			// Failing to create a directory is reported through the files that should go into it
+			if (i->is_directory(file_ec))
+			{
+				directories.create(target / file);
+			}
+			else if (i->is_regular_file(file_ec))
+			{
+				directories.create_parent(target / file);
+				files.emplace_back(std::move(file));
+			}
+		}
+
+		if (ec)
+		{
+			result.errors.emplace_back(src, ec);
+			return result;
+		}
+
+		auto is_unchanged = options.is_unchanged;
+		if (!is_unchanged)
+		{
+			is_unchanged = [](const std::filesystem::path&, const std::filesystem::path& from, const std::filesystem::path& to)
+			{
+				return files_match(from, to);
+			};
+		}
+
+		std::atomic_size_t next_file = 0;
+		std::mutex result_mutex{};
+
+		const auto worker = [&]
+		{
+			while (true)
+			{
+				const auto index = next_file++;
+				if (index >= files.size())
+				{
+					break;
+				}
+
+				const auto& file = files[index];
+				const auto from = src / file;
+				const auto to = target / file;
+
+				if (is_unchanged(file, from, to))
+				{
+					std::lock_guard _(result_mutex);
+					result.unchanged.emplace_back(file);
+					continue;
+				}
+
+				std::error_code file_ec;
+				const auto transferred = transfer(from, to, options.move, file_ec);
+
+				std::lock_guard _(result_mutex);
+				if (transferred)
+				{
+					result.copied.emplace_back(file);
+				}
+				else
+				{
+					result.errors.emplace_back(file, file_ec);
+				}
+			}
+		};
+
+		const auto thread_count = std::clamp<std::size_t>(files.size() / MIN_FILES_PER_THREAD, 1, std::max(std::thread::hardware_concurrency(), 1u));
+
+		std::vector<std::thread> threads{};
+		threads.reserve(thread_count - 1);
+
+		for (std::size_t i = 1; i < thread_count; ++i)
+		{
+			threads.emplace_back(worker);
+		}
+
+		worker();
+
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+
+		return result;
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace utils::io
+{
+	// Copies src over target, which is replaced in a single step. The data is cloned where the filesystem
+	// can share it (FICLONE on btrfs/XFS, clonefile on APFS), otherwise the kernel copies it (copy_file_range)
+	bool copy_file(const std::filesystem::path& src, const std::filesystem::path& target, std::error_code& ec);
+
+	// Same size and CRC32
+	bool files_match(const std::filesystem::path& a, const std::filesystem::path& b);
+
+	struct copy_options
+	{
+		// Renames files instead of copying them. Files that are on a different filesystem are still copied
+		bool move = false;
+
+		// Files for which this returns true are already in place and left alone. Called from several threads.
+		// Defaults to files_match
+		std::function<bool(const std::filesystem::path& file, const std::filesystem::path& src, const std::filesystem::path& target)> is_unchanged;
+	};
+
+	struct copy_result
+	{
+		// Paths relative to the source folder
+		std::vector<std::filesystem::path> copied;
+		std::vector<std::filesystem::path> unchanged;
+		std::vector<std::pair<std::filesystem::path, std::error_code>> errors;
+	};
+
+	// Copies every file below src to the same place below target, several files at once.
+	// A file that fails does not stop the others, every failure is reported
+	copy_result copy_folder(const std::filesystem::path& src, const std::filesystem::path& target, const copy_options& options = {});
+}
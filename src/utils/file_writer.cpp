@@ -0,0 +1,251 @@
+#include <std_include.hpp>
+
+#include "file_writer.hpp"
+#include "io.hpp"
+
+#ifndef _WIN32
+#include <cerrno>
+#endif
+
+namespace utils::io
+{
+	namespace
+	{
+		// Some platforms cap the size of a single read/write call, keep each call well below that
+		constexpr std::size_t MAX_WRITE_SIZE = 1u << 30;
+	}
+
+	file_writer::file_writer(const std::filesystem::path& file, const bool append)
+	{
+		// The parent directory usually exists already, only create it when opening fails because it doesn't
+#ifdef _WIN32
+		const auto open = [&]
+		{
+			return CreateFileW(file.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+			                   append ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		};
+
+		this->handle_ = open();
+		if (this->handle_ == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PATH_NOT_FOUND && file.has_parent_path())
+		{
+			io::create_directory(file.parent_path());
+			this->handle_ = open();
+		}
+
+		if (this->handle_ == INVALID_HANDLE_VALUE)
+		{
+			return;
+		}
+
+		if (append)
+		{
+			LARGE_INTEGER size{};
+			if (GetFileSizeEx(this->handle_, &size))
+			{
+				this->offset_ = static_cast<std::uint64_t>(size.QuadPart);
+			}
+		}
+#else
+		auto flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+		if (!append)
+		{
+			flags |= O_TRUNC;
+		}
+
+		this->fd_ = ::open(file.c_str(), flags, 0644);
+		if (this->fd_ < 0 && errno == ENOENT && file.has_parent_path())
+		{
+			io::create_directory(file.parent_path());
+			this->fd_ = ::open(file.c_str(), flags, 0644);
+		}
+
+		if (this->fd_ < 0)
+		{
+			return;
+		}
+
+		if (append)
+		{
+			const auto end = ::lseek(this->fd_, 0, SEEK_END);
+			this->offset_ = end > 0 ? static_cast<std::uint64_t>(end) : 0;
+		}
+#endif
+	}
+
+	file_writer::~file_writer()
+	{
+		this->close();
+	}
+
+	file_writer::file_writer(file_writer&& obj) noexcept
+	{
+		this->operator=(std::move(obj));
+	}
+
+	file_writer& file_writer::operator=(file_writer&& obj) noexcept
+	{
+		if (this != &obj)
+		{
+			this->close();
+
+#ifdef _WIN32
+			this->handle_ = obj.handle_;
+			obj.handle_ = INVALID_HANDLE_VALUE;
+#else
+			this->fd_ = obj.fd_;
+			obj.fd_ = -1;
+#endif
+			this->offset_ = obj.offset_;
+			obj.offset_ = 0;
+		}
+
+		return *this;
+	}
+
+	bool file_writer::is_open() const
+	{
+#ifdef _WIN32
+		return this->handle_ != INVALID_HANDLE_VALUE;
+#else
+		return this->fd_ >= 0;
+#endif
+	}
+
+	std::uint64_t file_writer::offset() const
+	{
+		return this->offset_;
+	}
+
+	bool file_writer::preallocate(const std::uint64_t size)
+	{
+		if (!this->is_open() || !size)
+		{
+			return false;
+		}
+
+#ifdef _WIN32
+		FILE_ALLOCATION_INFO info{};
+		info.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+		return SetFileInformationByHandle(this->handle_, FileAllocationInfo, &info, sizeof(info)) != FALSE;
+#elif defined(__APPLE__)
+		fstore_t store{};
+		store.fst_flags = F_ALLOCATECONTIG;
+		store.fst_posmode = F_PEOFPOSMODE;
+		store.fst_offset = 0;
+		store.fst_length = static_cast<off_t>(size);
+
+		if (::fcntl(this->fd_, F_PREALLOCATE, &store) == -1)
+		{
+			// Contiguous space is not available, settle for any space
+			store.fst_flags = F_ALLOCATEALL;
+			return ::fcntl(this->fd_, F_PREALLOCATE, &store) != -1;
+		}
+
+		return true;
+#elif defined(__linux__)
+		// Keep the size so a partially written file never looks complete
+		return ::fallocate(this->fd_, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size)) == 0;
+#else
+		return false;
+#endif
+	}
+
+	bool file_writer::set_direct_io(const bool enabled)
+	{
+		if (!this->is_open())
+		{
+			return false;
+		}
+
+#if defined(__APPLE__)
+		return ::fcntl(this->fd_, F_NOCACHE, enabled ? 1 : 0) != -1;
+#elif defined(__linux__)
+		const auto flags = ::fcntl(this->fd_, F_GETFL);
+		if (flags == -1)
+		{
+			return false;
+		}
+
+		return ::fcntl(this->fd_, F_SETFL, enabled ? flags | O_DIRECT : flags & ~O_DIRECT) != -1;
+#else
+		// The handle would have to be opened with FILE_FLAG_NO_BUFFERING, which can't be undone for the tail
+		return !enabled;
+#endif
+	}
+
+	bool file_writer::write(const void* data, const std::size_t size)
+	{
+		if (!this->write_at(this->offset_, data, size))
+		{
+			return false;
+		}
+
+		this->offset_ += size;
+		return true;
+	}
+
+	bool file_writer::write_at(std::uint64_t offset, const void* data, std::size_t size)
+	{
+		if (!this->is_open())
+		{
+			return false;
+		}
+
+		const auto* buffer = static_cast<const char*>(data);
+		while (size > 0)
+		{
+			const auto chunk = std::min(size, MAX_WRITE_SIZE);
+
+#ifdef _WIN32
+			OVERLAPPED overlapped{};
+			overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+			overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+			DWORD written = 0;
+			if (!WriteFile(this->handle_, buffer, static_cast<DWORD>(chunk), &written, &overlapped) || !written)
+			{
+				return false;
+			}
+#else
+			const auto written = ::pwrite(this->fd_, buffer, chunk, static_cast<off_t>(offset));
+			if (written < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+
+				return false;
+			}
+
+			if (!written)
+			{
+				return false;
+			}
+#endif
+
+			buffer += written;
+			offset += static_cast<std::uint64_t>(written);
+			size -= static_cast<std::size_t>(written);
+		}
+
+		return true;
+	}
+
+	void file_writer::close()
+	{
+#ifdef _WIN32
+		if (this->handle_ != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(this->handle_);
+			this->handle_ = INVALID_HANDLE_VALUE;
+		}
+#else
+		if (this->fd_ >= 0)
+		{
+			::close(this->fd_);
+			this->fd_ = -1;
+		}
+#endif
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+namespace utils::io
+{
+	// Thin wrapper around a native file handle. Writes bypass the C++ stream layer
+	// so callers control buffering, and write_at can be used from several threads
+	class file_writer
+	{
+	public:
+		file_writer() = default;
+		explicit file_writer(const std::filesystem::path& file, bool append = false);
+		~file_writer();
+
+		file_writer(file_writer&& obj) noexcept;
+		file_writer& operator=(file_writer&& obj) noexcept;
+
+		file_writer(const file_writer&) = delete;
+		file_writer& operator=(const file_writer&) = delete;
+
+		[[nodiscard]] bool is_open() const;
+		[[nodiscard]] std::uint64_t offset() const;
+
+		// Reserves disk space without changing the file size. This is only a hint, failure is not fatal
+		bool preallocate(std::uint64_t size);
+
+		// Bypasses the page cache (O_DIRECT on Linux, F_NOCACHE on macOS). Direct writes on Linux must use
+		// aligned buffers, sizes and offsets. Returns false if the platform or filesystem can't do it
+		bool set_direct_io(bool enabled);
+
+		bool write(const void* data, std::size_t size);
+		bool write_at(std::uint64_t offset, const void* data, std::size_t size);
+
+		void close();
+
+	private:
+#ifdef _WIN32
+		HANDLE handle_ = INVALID_HANDLE_VALUE;
+#else
+		int fd_ = -1;
+#endif
+		std::uint64_t offset_ = 0;
+	};
+}
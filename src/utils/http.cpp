@@ -1,53 +1,1446 @@
 #include <std_include.hpp>
 
 #include "http.hpp"
+#include "file_writer.hpp"
+#include "io.hpp"
+#include "sha256.hpp"
+#include "string.hpp"
+
 #include <curl/curl.h>
 
-namespace utils::http
-{
-	namespace
-	{
-		size_t write_callback(void* contents, const size_t size, const size_t nmemb, void* userp)
+namespace utils::http
+{
+	namespace
+	{
+		// Downloads are staged in fixed-size buffers so disk writes happen in large blocks
+		constexpr std::size_t DOWNLOAD_BUFFER_SIZE = 1024 * 1024;
+		constexpr std::size_t DOWNLOAD_BUFFER_COUNT = 8;
+
+		// Segments are never made smaller than this, small files are not worth splitting
+		constexpr std::uint64_t MIN_SEGMENT_SIZE = 4 * 1024 * 1024;
+
+		// A streamed download is fetched front to back in pieces of about this size, so the part that can be
+		// passed on grows steadily instead of waiting for the first of a few huge segments. The connections
+		// are at most one piece each ahead of it
+		constexpr std::uint64_t STREAM_RANGE_SIZE = MIN_SEGMENT_SIZE;
+		constexpr std::size_t MAX_SEGMENT_RETRIES = 3;
+
+		// Transfers beyond this wait in the engine's queue
+		constexpr std::size_t MAX_ACTIVE_TRANSFERS = 64;
+
+		// How much a transfer may burst above the rate limit after being idle
+		constexpr auto RATE_LIMIT_BURST = 250ms;
+
+		// How often the resume sidecar is rewritten while a download is running
+		constexpr auto RESUME_SAVE_INTERVAL = 1s;
+
+		using byte_range = std::pair<std::uint64_t, std::uint64_t>;
+
+		struct resume_state
+		{
+			std::string url;
+			std::string etag;
+			std::string last_modified;
+			std::uint64_t size = 0;
+
+			// Byte ranges [first, second) that are still missing
+			std::vector<byte_range> pending;
+		};
+
+		// Hands out at most DOWNLOAD_BUFFER_COUNT buffers. They are recycled instead of freed,
+		// which keeps peak memory usage constant no matter how much data goes through them
+		class buffer_pool
+		{
+		public:
+			std::unique_ptr<char[]> acquire()
+			{
+				std::unique_lock lock(this->mutex_);
+				this->cv_.wait(lock, [this]
+				{
+					return !this->free_.empty() || this->allocated_ < DOWNLOAD_BUFFER_COUNT;
+				});
+
+				if (!this->free_.empty())
+				{
+					auto buffer = std::move(this->free_.back());
+					this->free_.pop_back();
+					return buffer;
+				}
+
+				++this->allocated_;
+				return std::make_unique<char[]>(DOWNLOAD_BUFFER_SIZE);
+			}
+
+			void release(std::unique_ptr<char[]> buffer)
+			{
+				{
+					std::lock_guard _(this->mutex_);
+					this->free_.emplace_back(std::move(buffer));
+				}
+
+				this->cv_.notify_one();
+			}
+
+		private:
+			std::mutex mutex_;
+			std::condition_variable cv_;
+			std::vector<std::unique_ptr<char[]>> free_;
+			std::size_t allocated_ = 0;
+		};
+
+		buffer_pool& get_buffer_pool()
+		{
+			static buffer_pool pool;
+			return pool;
+		}
+
+		class download_buffer
+		{
+		public:
+			download_buffer()
+				: buffer_(get_buffer_pool().acquire())
+			{
+			}
+
+			~download_buffer()
+			{
+				get_buffer_pool().release(std::move(this->buffer_));
+			}
+
+			download_buffer(download_buffer&&) = delete;
+			download_buffer(const download_buffer&) = delete;
+			download_buffer& operator=(download_buffer&&) = delete;
+			download_buffer& operator=(const download_buffer&) = delete;
+
+			[[nodiscard]] char* get() const
+			{
+				return this->buffer_.get();
+			}
+
+		private:
+			std::unique_ptr<char[]> buffer_;
+		};
+
+		// Easy handles are recycled and share their DNS cache and TLS sessions, so only the first request
+		// to a host pays for the lookup and the full handshake. Connections are not shared, handles run on
+		// several threads at once and libcurl can't share a connection cache between those. A recycled handle
+		// keeps its own connections, and each multi handle keeps those of its transfers
+		class client
+		{
+		public:
+			client()
+			{
+				curl_global_init(CURL_GLOBAL_DEFAULT);
+
+				this->share_ = curl_share_init();
+				curl_share_setopt(this->share_, CURLSHOPT_LOCKFUNC, lock_callback);
+				curl_share_setopt(this->share_, CURLSHOPT_UNLOCKFUNC, unlock_callback);
+				curl_share_setopt(this->share_, CURLSHOPT_USERDATA, this);
+				curl_share_setopt(this->share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+				curl_share_setopt(this->share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+			}
+
+			~client()
+			{
+				for (auto* curl : this->idle_)
+				{
+					curl_easy_cleanup(curl);
+				}
+
+				curl_share_cleanup(this->share_);
+				curl_global_cleanup();
+			}
+
+			client(client&&) = delete;
+			client(const client&) = delete;
+			client& operator=(client&&) = delete;
+			client& operator=(const client&) = delete;
+
+			CURL* acquire()
+			{
+				{
+					std::lock_guard _(this->mutex_);
+					if (!this->idle_.empty())
+					{
+						auto* curl = this->idle_.back();
+						this->idle_.pop_back();
+						return curl;
+					}
+				}
+
+				return curl_easy_init();
+			}
+
+			void release(CURL* curl)
+			{
+				if (!curl)
+				{
+					return;
+				}
+
+				// Resetting the options keeps the caches and live connections
+				curl_easy_reset(curl);
+
+				std::lock_guard _(this->mutex_);
+				if (this->idle_.size() < MAX_IDLE_HANDLES)
+				{
+					this->idle_.emplace_back(curl);
+					return;
+				}
+
+				curl_easy_cleanup(curl);
+			}
+
+			[[nodiscard]] CURLSH* get_share() const
+			{
+				return this->share_;
+			}
+
+			void record_timings(CURL* curl)
+			{
+				curl_off_t name_lookup = 0, connect = 0, app_connect = 0;
+				long new_connections = 0;
+
+				curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &name_lookup);
+				curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+				curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &app_connect);
+				curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &new_connections);
+
+				// The values are measured from the start of the transfer, each one includes the previous
+				std::lock_guard _(this->mutex_);
+				++this->timings_.requests;
+				this->timings_.connections += static_cast<std::size_t>(new_connections);
+				this->timings_.dns += std::chrono::microseconds(name_lookup);
+				this->timings_.connect += std::chrono::microseconds(std::max<curl_off_t>(connect - name_lookup, 0));
+				this->timings_.tls += std::chrono::microseconds(app_connect > 0 ? std::max<curl_off_t>(app_connect - connect, 0) : 0);
+			}
+
+			[[nodiscard]] timings get_timings()
+			{
+				std::lock_guard _(this->mutex_);
+				return this->timings_;
+			}
+
+		private:
+			static constexpr std::size_t MAX_IDLE_HANDLES = 16;
+
+			CURLSH* share_{};
+			std::mutex share_mutexes_[CURL_LOCK_DATA_LAST]{};
+
+			std::mutex mutex_;
+			std::vector<CURL*> idle_;
+			timings timings_{};
+
+			static void lock_callback(CURL*, const curl_lock_data data, curl_lock_access, void* userptr)
+			{
+				static_cast<client*>(userptr)->share_mutexes_[data].lock();
+			}
+
+			static void unlock_callback(CURL*, const curl_lock_data data, void* userptr)
+			{
+				static_cast<client*>(userptr)->share_mutexes_[data].unlock();
+			}
+		};
+
+		client& get_client()
+		{
+			static client client;
+			return client;
+		}
+
+		class easy_handle
+		{
+		public:
+			easy_handle()
+				: curl_(get_client().acquire())
+			{
+			}
+
+			~easy_handle()
+			{
+				get_client().release(this->curl_);
+			}
+
+			easy_handle(easy_handle&&) = delete;
+			easy_handle(const easy_handle&) = delete;
+			easy_handle& operator=(easy_handle&&) = delete;
+			easy_handle& operator=(const easy_handle&) = delete;
+
+			[[nodiscard]] CURL* get() const
+			{
+				return this->curl_;
+			}
+
+			CURLcode perform() const
+			{
+				const auto result = curl_easy_perform(this->curl_);
+				get_client().record_timings(this->curl_);
+				return result;
+			}
+
+		private:
+			CURL* curl_;
+		};
+
+		// Token bucket shared by all transfers. Every write callback pays for the bytes it received.
+		// A transfer that has its thread to itself sleeps off any debt, one that shares a multi handle
+		// pauses instead and is resumed by the loop driving it. Once we stop reading, TCP flow control
+		// slows the sender down
+		class rate_limiter
+		{
+		public:
+			void set_rate(const std::uint64_t bytes_per_second)
+			{
+				std::lock_guard _(this->mutex_);
+				this->rate_ = bytes_per_second;
+				this->tokens_ = 0.0;
+				this->last_refill_ = std::chrono::steady_clock::now();
+			}
+
+			[[nodiscard]] std::uint64_t get_rate()
+			{
+				std::lock_guard _(this->mutex_);
+				return this->rate_;
+			}
+
+			void consume(const std::size_t bytes)
+			{
+				std::chrono::duration<double> wait{};
+
+				{
+					std::lock_guard _(this->mutex_);
+					if (!this->rate_)
+					{
+						return;
+					}
+
+					this->refill();
+					this->tokens_ -= static_cast<double>(bytes);
+
+					if (this->tokens_ < 0.0)
+					{
+						wait = std::chrono::duration<double>(-this->tokens_ / static_cast<double>(this->rate_));
+					}
+				}
+
+				if (wait.count() > 0.0)
+				{
+					std::this_thread::sleep_for(wait);
+				}
+			}
+
+			// Never blocks. Takes the bytes unless the bucket is still in debt, the caller has to pause then
+			bool try_consume(const std::size_t bytes)
+			{
+				std::lock_guard _(this->mutex_);
+				if (!this->rate_)
+				{
+					return true;
+				}
+
+				this->refill();
+				if (this->tokens_ < 0.0)
+				{
+					return false;
+				}
+
+				this->tokens_ -= static_cast<double>(bytes);
+				return true;
+			}
+
+			// How long until try_consume takes bytes again
+			[[nodiscard]] std::chrono::milliseconds get_wait_time()
+			{
+				std::lock_guard _(this->mutex_);
+				if (!this->rate_)
+				{
+					return {};
+				}
+
+				this->refill();
+				if (this->tokens_ >= 0.0)
+				{
+					return {};
+				}
+
+				return std::chrono::ceil<std::chrono::milliseconds>(std::chrono::duration<double>(-this->tokens_ / static_cast<double>(this->rate_)));
+			}
+
+		private:
+			std::mutex mutex_;
+			std::uint64_t rate_ = 0;
+			double tokens_ = 0.0;
+			std::chrono::steady_clock::time_point last_refill_{};
+
+			void refill()
+			{
+				const auto rate = static_cast<double>(this->rate_);
+				const auto now = std::chrono::steady_clock::now();
+				const auto elapsed = std::chrono::duration<double>(now - this->last_refill_).count();
+				const auto burst = rate * std::chrono::duration<double>(RATE_LIMIT_BURST).count();
+
+				this->tokens_ = std::min(burst, this->tokens_ + elapsed * rate);
+				this->last_refill_ = now;
+			}
+		};
+
+		rate_limiter& get_rate_limiter()
+		{
+			static rate_limiter limiter;
+			return limiter;
+		}
+
+		// Paused transfers are resumed once the rate limit allows it, not only when the next packet arrives
+		int get_poll_timeout(const bool paused)
+		{
+			constexpr auto timeout = 1000;
+			if (!paused)
+			{
+				return timeout;
+			}
+
+			return static_cast<int>(std::clamp<std::int64_t>(get_rate_limiter().get_wait_time().count(), 1, timeout));
+		}
+
+		struct download_context
+		{
+			CURL* curl{};
+			io::file_writer* writer{};
+			const download_options* options{};
+			sha256* hash{};
+			download_buffer buffer{};
+			std::size_t buffered = 0;
+			bool preallocated = false;
+
+			bool flush()
+			{
+				if (!this->buffered)
+				{
+					return true;
+				}
+
+				const auto result = this->writer->write(this->buffer.get(), this->buffered);
+				this->buffered = 0;
+				return result;
+			}
+		};
+
+		size_t write_callback(void* contents, const size_t size, const size_t nmemb, void* userp)
+		{
+			get_rate_limiter().consume(size * nmemb);
+			static_cast<std::string*>(userp)->append(static_cast<char*>(contents), size * nmemb);
+			return size * nmemb;
+		}
+
+		size_t file_write_callback(void* contents, const size_t size, const size_t nmemb, void* userp)
+		{
+			auto* context = static_cast<download_context*>(userp);
+			const auto length = size * nmemb;
+
+			get_rate_limiter().consume(length);
+
+			if (!context->preallocated)
+			{
+				context->preallocated = true;
+
+				curl_off_t content_length = -1;
+				if (curl_easy_getinfo(context->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length) == CURLE_OK && content_length > 0)
+				{
+					context->writer->preallocate(static_cast<std::uint64_t>(content_length));
+				}
+			}
+
+			const auto* data = static_cast<const char*>(contents);
+			auto remaining = length;
+
+			if (context->hash)
+			{
+				context->hash->update(data, length);
+			}
+
+			if (context->options->on_data)
+			{
+				context->options->on_data(data, length);
+			}
+
+			while (remaining > 0)
+			{
+				const auto chunk = std::min(remaining, DOWNLOAD_BUFFER_SIZE - context->buffered);
+				std::memcpy(context->buffer.get() + context->buffered, data, chunk);
+
+				context->buffered += chunk;
+				data += chunk;
+				remaining -= chunk;
+
+				// Returning anything other than length makes cURL abort the transfer
+				if (context->buffered == DOWNLOAD_BUFFER_SIZE && !context->flush())
+				{
+					return 0;
+				}
+			}
+
+			return length;
+		}
+
+		struct segment
+		{
+			CURL* curl{};
+			io::file_writer* writer{};
+			std::unique_ptr<download_buffer> buffer{};
+			std::size_t buffered = 0;
+
+			std::uint64_t requested = 0; // First byte of the current request
+			std::uint64_t offset = 0; // Next byte we expect from the server
+			std::uint64_t end = 0; // Exclusive, lowered when the segment gets split
+
+			std::size_t source = 0;
+			std::size_t retries = 0;
+			bool active = false;
+			bool paused = false;
+			bool rejected = false;
+			bool write_failed = false;
+
+			[[nodiscard]] bool is_complete() const
+			{
+				return this->offset >= this->end;
+			}
+
+			// Bytes that could not be written stay buffered, so they still count as missing
+			bool flush()
+			{
+				if (!this->buffered)
+				{
+					return true;
+				}
+
+				if (!this->writer->write_at(this->offset - this->buffered, this->buffer->get(), this->buffered))
+				{
+					this->write_failed = true;
+					return false;
+				}
+
+				this->buffered = 0;
+				return true;
+			}
+		};
+
+		size_t segment_write_callback(void* contents, const size_t size, const size_t nmemb, void* userp)
+		{
+			auto* segment = static_cast<struct segment*>(userp);
+			const auto length = size * nmemb;
+
+			// Sleeping here would hold up every other segment, cURL delivers the same data again once resumed
+			if (!get_rate_limiter().try_consume(length))
+			{
+				segment->paused = true;
+				return CURL_WRITEFUNC_PAUSE;
+			}
+
+			if (segment->offset == segment->requested)
+			{
+				// A server that ignores the Range header sends the whole file, which must not land at our offset
+				long status = 0;
+				curl_easy_getinfo(segment->curl, CURLINFO_RESPONSE_CODE, &status);
+				if (status != 206)
+				{
+					segment->rejected = true;
+					return 0;
+				}
+			}
+
+			if (segment->is_complete())
+			{
+				segment->flush();
+				return 0;
+			}
+
+			const auto accepted = static_cast<std::size_t>(std::min<std::uint64_t>(length, segment->end - segment->offset));
+			const auto* data = static_cast<const char*>(contents);
+			auto remaining = accepted;
+
+			while (remaining > 0)
+			{
+				const auto chunk = std::min(remaining, DOWNLOAD_BUFFER_SIZE - segment->buffered);
+				std::memcpy(segment->buffer->get() + segment->buffered, data, chunk);
+
+				segment->buffered += chunk;
+				segment->offset += chunk;
+				data += chunk;
+				remaining -= chunk;
+
+				if (segment->buffered == DOWNLOAD_BUFFER_SIZE && !segment->flush())
+				{
+					return 0;
+				}
+			}
+
+			// The segment was shortened while this request was running. Everything past the new end
+			// belongs to another segment, so stop the transfer here
+			if (accepted < length)
+			{
+				segment->flush();
+				return 0;
+			}
+
+			return length;
+		}
+
+		std::string trim_header_value(const std::string& value)
+		{
+			const auto begin = value.find_first_not_of(" \t\r\n");
+			if (begin == std::string::npos)
+			{
+				return {};
+			}
+
+			const auto end = value.find_last_not_of(" \t\r\n");
+			return value.substr(begin, end - begin + 1);
+		}
+
+		struct source
+		{
+			std::string url;
+			std::optional<file_info> info{};
+			curl_slist* header_list{};
+			bool failed = false;
+		};
+
+		size_t file_info_header_callback(char* buffer, const size_t size, const size_t nitems, void* userdata)
+		{
+			auto* info = static_cast<file_info*>(userdata);
+			const auto length = size * nitems;
+
+			const std::string line(buffer, length);
+			const auto pos = line.find(':');
+			if (pos == std::string::npos)
+			{
+				// Status line of a new response (after a redirect). Forget what the previous one said
+				if (string::starts_with(line, "HTTP/"))
+				{
+					info->accepts_ranges = false;
+					info->etag.clear();
+					info->last_modified.clear();
+				}
+
+				return length;
+			}
+
+			const auto name = string::to_lower(line.substr(0, pos));
+			const auto value = trim_header_value(line.substr(pos + 1));
+
+			if (name == "accept-ranges")
+			{
+				info->accepts_ranges = string::to_lower(value).find("bytes") != std::string::npos;
+			}
+			else if (name == "etag")
+			{
+				info->etag = value;
+			}
+			else if (name == "last-modified")
+			{
+				info->last_modified = value;
+			}
+
+			return length;
+		}
+
+		curl_slist* build_header_list(const headers& headers)
+		{
+			curl_slist* header_list = nullptr;
+			for (const auto& header : headers)
+			{
+				auto data = header.first + ": "s + header.second;
+				header_list = curl_slist_append(header_list, data.c_str());
+			}
+
+			return header_list;
+		}
+
+		void setup_handle(CURL* curl, const std::string& url, curl_slist* header_list)
+		{
+			curl_easy_setopt(curl, CURLOPT_SHARE, get_client().get_share());
+			curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header_list);
+			curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+			curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+			curl_easy_setopt(curl, CURLOPT_USERAGENT, "aw-installer/1.0");
+			curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+			curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+			curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+		}
+
+		std::filesystem::path get_resume_file(const std::filesystem::path& file)
+		{
+			auto resume_file = file;
+			resume_file += ".resume";
+			return resume_file;
+		}
+
+		std::optional<resume_state> load_resume_state(const std::filesystem::path& file)
+		{
+			std::string data;
+			if (!io::read_file(get_resume_file(file).string(), &data) || data.empty())
+			{
+				return {};
+			}
+
+			rapidjson::Document doc{};
+			const rapidjson::ParseResult result = doc.Parse(data);
+			if (!result || !doc.IsObject())
+			{
+				return {};
+			}
+
+			if (!doc.HasMember("url") || !doc["url"].IsString() ||
+				!doc.HasMember("etag") || !doc["etag"].IsString() ||
+				!doc.HasMember("last_modified") || !doc["last_modified"].IsString() ||
+				!doc.HasMember("size") || !doc["size"].IsUint64() ||
+				!doc.HasMember("pending") || !doc["pending"].IsArray())
+			{
+				return {};
+			}
+
+			resume_state state{};
+			state.url = doc["url"].GetString();
+			state.etag = doc["etag"].GetString();
+			state.last_modified = doc["last_modified"].GetString();
+			state.size = doc["size"].GetUint64();
+
+			for (const auto& range : doc["pending"].GetArray())
+			{
+				if (!range.IsArray() || range.Size() != 2 || !range[0u].IsUint64() || !range[1u].IsUint64())
+				{
+					return {};
+				}
+
+				const auto begin = range[0u].GetUint64();
+				const auto end = range[1u].GetUint64();
+				if (begin >= end || end > state.size)
+				{
+					return {};
+				}
+
+				state.pending.emplace_back(begin, end);
+			}
+
+			return {std::move(state)};
+		}
+
+		void save_resume_state(const std::filesystem::path& file, const resume_state& state)
+		{
+			rapidjson::Document doc{};
+			doc.SetObject();
+
+			auto received = state.size;
+			rapidjson::Value pending(rapidjson::kArrayType);
+			for (const auto& [begin, end] : state.pending)
+			{
+				rapidjson::Value range(rapidjson::kArrayType);
+				range.PushBack(begin, doc.GetAllocator());
+				range.PushBack(end, doc.GetAllocator());
+				pending.PushBack(range, doc.GetAllocator());
+
+				received -= end - begin;
+			}
+
+			rapidjson::Value url{};
+			url.SetString(state.url, doc.GetAllocator());
+
+			rapidjson::Value etag{};
+			etag.SetString(state.etag, doc.GetAllocator());
+
+			rapidjson::Value last_modified{};
+			last_modified.SetString(state.last_modified, doc.GetAllocator());
+
+			doc.AddMember("url", url, doc.GetAllocator());
+			doc.AddMember("etag", etag, doc.GetAllocator());
+			doc.AddMember("last_modified", last_modified, doc.GetAllocator());
+			doc.AddMember("size", state.size, doc.GetAllocator());
+			doc.AddMember("received", received, doc.GetAllocator());
+			doc.AddMember("pending", pending, doc.GetAllocator());
+
+			rapidjson::StringBuffer buffer{};
+			rapidjson::Writer<rapidjson::StringBuffer, rapidjson::Document::EncodingType, rapidjson::ASCII<>>
+				writer(buffer);
+			doc.Accept(writer);
+
+			io::write_file(get_resume_file(file).string(), std::string(buffer.GetString(), buffer.GetLength()));
+		}
+
+		void remove_resume_state(const std::filesystem::path& file)
+		{
+			io::remove_file(get_resume_file(file).string());
+		}
+
+		// A partial download may only be continued if it was made from the very same remote file
+		bool can_resume(const resume_state& state, const std::string& url, const file_info& info, const std::filesystem::path& file)
+		{
+			if (state.url != url || state.size != info.size || !io::file_exists(file.string()))
+			{
+				return false;
+			}
+
+			if (!info.etag.empty())
+			{
+				return state.etag == info.etag;
+			}
+
+			return !info.last_modified.empty() && state.last_modified == info.last_modified;
+		}
+
+		int cancel_callback(void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t)
+		{
+			// Anything but 0 aborts the transfer
+			return static_cast<const std::atomic_bool*>(clientp)->load() ? 1 : 0;
+		}
+
+		void setup_cancellation(CURL* curl, const download_options& options)
+		{
+			if (!options.cancel)
+			{
+				return;
+			}
+
+			curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, cancel_callback);
+			curl_easy_setopt(curl, CURLOPT_XFERINFODATA, options.cancel);
+			curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+		}
+
+		bool is_cancelled(const download_options& options)
+		{
+			return options.cancel && options.cancel->load();
+		}
+
+		// Passes a segmented download on to on_data and the hash in order, on a thread of its own. It reads back
+		// what is already in the file, the bytes are still in the page cache at that point. However long the
+		// consumer takes, the transfers keep going
+		class stream_feeder
+		{
+		public:
+			stream_feeder(std::filesystem::path file, const download_options& options)
+				: file_(std::move(file))
+				, options_(options)
+			{
+				if (!this->options_.on_data && !this->options_.sha256)
+				{
+					return;
+				}
+
+				this->thread_ = std::thread([this]
+				{
+					this->run();
+				});
+			}
+
+			~stream_feeder()
+			{
+				this->aborted_ = true;
+				this->stop();
+			}
+
+			stream_feeder(stream_feeder&&) = delete;
+			stream_feeder(const stream_feeder&) = delete;
+			stream_feeder& operator=(stream_feeder&&) = delete;
+			stream_feeder& operator=(const stream_feeder&) = delete;
+
+			[[nodiscard]] bool is_streaming() const
+			{
+				return this->thread_.joinable();
+			}
+
+			// Everything in front of until is in the file
+			void advance(const std::uint64_t until)
+			{
+				{
+					std::lock_guard _(this->mutex_);
+					if (until <= this->until_)
+					{
+						return;
+					}
+
+					this->until_ = until;
+				}
+
+				this->cv_.notify_one();
+			}
+
+			[[nodiscard]] bool has_failed() const
+			{
+				return this->failed_;
+			}
+
+			// Waits until everything up to the last advance has been passed on
+			bool finish()
+			{
+				this->stop();
+
+				if (!this->failed_ && this->options_.sha256)
+				{
+					*this->options_.sha256 = this->hash_.finish_hex();
+				}
+
+				return !this->failed_;
+			}
+
+		private:
+			std::filesystem::path file_;
+			const download_options& options_;
+			sha256 hash_{};
+
+			std::thread thread_;
+			std::mutex mutex_;
+			std::condition_variable cv_;
+			std::uint64_t until_ = 0;
+			bool stopping_ = false;
+			std::atomic_bool aborted_ = false;
+			std::atomic_bool failed_ = false;
+
+			void stop()
+			{
+				{
+					std::lock_guard _(this->mutex_);
+					this->stopping_ = true;
+				}
+
+				this->cv_.notify_one();
+				if (this->thread_.joinable())
+				{
+					this->thread_.join();
+				}
+			}
+
+			void run()
+			{
+				std::ifstream reader(this->file_, std::ios::binary);
+				std::string buffer(DOWNLOAD_BUFFER_SIZE, '\0');
+				std::uint64_t streamed = 0;
+
+				while (!this->aborted_)
+				{
+					std::uint64_t until;
+
+					{
+						std::unique_lock lock(this->mutex_);
+						this->cv_.wait(lock, [&]
+						{
+							return this->stopping_ || streamed < this->until_;
+						});
+
+						if (streamed >= this->until_)
+						{
+							return;
+						}
+
+						until = this->until_;
+					}
+
+					reader.clear();
+					reader.seekg(static_cast<std::streamoff>(streamed));
+
+					while (streamed < until && !this->aborted_)
+					{
+						const auto chunk = static_cast<std::size_t>(std::min<std::uint64_t>(until - streamed, buffer.size()));
+						if (!reader.read(buffer.data(), static_cast<std::streamsize>(chunk)))
+						{
+							this->failed_ = true;
+							return;
+						}
+
+						if (this->options_.sha256)
+						{
+							this->hash_.update(buffer.data(), chunk);
+						}
+
+						if (this->options_.on_data)
+						{
+							this->options_.on_data(buffer.data(), chunk);
+						}
+
+						streamed += chunk;
+					}
+				}
+			}
+		};
+
+		void start_segment(CURLM* multi, segment& segment, const source& source, const download_options& options, const bool detect_stalls)
+		{
+			if (!segment.curl)
+			{
+				segment.curl = get_client().acquire();
+			}
+
+			const auto range = std::to_string(segment.offset) + "-" + std::to_string(segment.end - 1);
+
+			segment.requested = segment.offset;
+			segment.paused = false;
+			segment.rejected = false;
+			segment.active = true;
+
+			setup_handle(segment.curl, source.info->effective_url, source.header_list);
+			setup_cancellation(segment.curl, options);
+			curl_easy_setopt(segment.curl, CURLOPT_RANGE, range.c_str());
+			curl_easy_setopt(segment.curl, CURLOPT_WRITEFUNCTION, segment_write_callback);
+			curl_easy_setopt(segment.curl, CURLOPT_WRITEDATA, &segment);
+			curl_easy_setopt(segment.curl, CURLOPT_PRIVATE, &segment);
+
+			// A throttled connection would look stalled
+			if (detect_stalls && options.stall_speed && !get_rate_limiter().get_rate())
+			{
+				curl_easy_setopt(segment.curl, CURLOPT_LOW_SPEED_LIMIT, static_cast<long>(options.stall_speed));
+				curl_easy_setopt(segment.curl, CURLOPT_LOW_SPEED_TIME, static_cast<long>(options.stall_time.count()));
+			}
+
+			curl_multi_add_handle(multi, segment.curl);
+		}
+
+		// Sources are only asked for their details once they are needed. A source is usable if it supports
+		// ranges and serves a file of the expected size. A size of 0 accepts any size
+		bool prepare_source(source& source, const headers& headers, const std::uint64_t size)
+		{
+			if (source.failed)
+			{
+				return false;
+			}
+
+			if (source.header_list)
+			{
+				return true;
+			}
+
+			source.info = get_file_info(source.url, headers);
+			if (!source.info.has_value() || !source.info->accepts_ranges || !source.info->size || (size && source.info->size != size))
+			{
+				source.failed = true;
+				return false;
+			}
+
+			// Make sure a changed file is never stitched together with what we already have
+			auto request_headers = headers;
+			if (!source.info->etag.empty())
+			{
+				request_headers["If-Range"] = source.info->etag;
+			}
+			else if (!source.info->last_modified.empty())
+			{
+				request_headers["If-Range"] = source.info->last_modified;
+			}
+
+			source.header_list = build_header_list(request_headers);
+			return true;
+		}
+
+		class engine
+		{
+		public:
+			engine()
+			{
+				// The client must outlive the engine
+				get_client();
+
+				this->multi_ = curl_multi_init();
+				curl_multi_setopt(this->multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+				this->thread_ = std::thread([this]
+				{
+					this->run();
+				});
+			}
+
+			~engine()
+			{
+				{
+					std::lock_guard _(this->mutex_);
+					this->stopping_ = true;
+				}
+
+				curl_multi_wakeup(this->multi_);
+				if (this->thread_.joinable())
+				{
+					this->thread_.join();
+				}
+
+				curl_multi_cleanup(this->multi_);
+			}
+
+			engine(engine&&) = delete;
+			engine(const engine&) = delete;
+			engine& operator=(engine&&) = delete;
+			engine& operator=(const engine&) = delete;
+
+			request_id submit(const std::string& url, const request_options& options, completion_callback callback)
+			{
+				auto transfer = std::make_unique<struct transfer>();
+				transfer->url = url;
+				transfer->options = options;
+				transfer->callback = std::move(callback);
+
+				request_id id;
+
+				{
+					std::lock_guard _(this->mutex_);
+					id = ++this->next_id_;
+					transfer->id = id;
+
+					if (!this->stopping_)
+					{
+						this->get_queue(options.priority).emplace_back(std::move(transfer));
+					}
+				}
+
+				if (transfer)
+				{
+					// Too late, the engine is shutting down
+					transfer->callback({});
+					return id;
+				}
+
+				curl_multi_wakeup(this->multi_);
+				return id;
+			}
+
+			bool cancel(const request_id id)
+			{
+				{
+					std::lock_guard _(this->mutex_);
+
+					auto found = false;
+					for (auto& queue : this->queues_)
+					{
+						const auto entry = std::find_if(queue.begin(), queue.end(), [id](const auto& queued)
+						{
+							return queued->id == id;
+						});
+
+						if (entry != queue.end())
+						{
+							// The engine thread invokes the callback, like it does for every other request
+							this->cancelled_queued_.emplace_back(std::move(*entry));
+							queue.erase(entry);
+							found = true;
+							break;
+						}
+					}
+
+					if (!found)
+					{
+						if (!this->running_ids_.contains(id))
+						{
+							return false;
+						}
+
+						this->cancelled_ids_.emplace(id);
+					}
+				}
+
+				curl_multi_wakeup(this->multi_);
+				return true;
+			}
+
+		private:
+			struct transfer
+			{
+				request_id id{};
+				std::string url;
+				request_options options;
+				completion_callback callback;
+
+				CURL* curl{};
+				curl_slist* header_list{};
+				std::string buffer;
+				bool paused = false;
+			};
+
+			CURLM* multi_{};
+			std::thread thread_;
+
+			std::mutex mutex_;
+			bool stopping_ = false;
+			request_id next_id_ = 0;
+			std::deque<std::unique_ptr<transfer>> queues_[3];
+			std::unordered_set<request_id> running_ids_;
+			std::unordered_set<request_id> cancelled_ids_;
+			std::vector<std::unique_ptr<transfer>> cancelled_queued_;
+
+			// Only touched by the engine thread
+			std::unordered_map<request_id, std::unique_ptr<transfer>> active_;
+
+			std::deque<std::unique_ptr<transfer>>& get_queue(const priority priority)
+			{
+				return this->queues_[static_cast<std::size_t>(priority)];
+			}
+
+			static size_t transfer_write_callback(void* contents, const size_t size, const size_t nmemb, void* userp)
+			{
+				auto* transfer = static_cast<struct transfer*>(userp);
+				const auto length = size * nmemb;
+
+				// Sleeping here would hold up every other transfer of the engine
+				if (!get_rate_limiter().try_consume(length))
+				{
+					transfer->paused = true;
+					return CURL_WRITEFUNC_PAUSE;
+				}
+
+				if (transfer->options.max_size && transfer->buffer.size() + length > transfer->options.max_size)
+				{
+					return 0;
+				}
+
+				transfer->buffer.append(static_cast<char*>(contents), length);
+				return length;
+			}
+
+			static long get_stream_weight(const priority priority)
+			{
+				switch (priority)
+				{
+				case priority::low:
+					return 8;
+				case priority::high:
+					return 64;
+				default:
+					return 16;
+				}
+			}
+
+			void start(std::unique_ptr<transfer> transfer)
+			{
+				transfer->curl = get_client().acquire();
+				if (!transfer->curl)
+				{
+					{
+						std::lock_guard _(this->mutex_);
+						this->running_ids_.erase(transfer->id);
+						this->cancelled_ids_.erase(transfer->id);
+					}
+
+					transfer->callback({});
+					return;
+				}
+
+				transfer->header_list = build_header_list(transfer->options.headers);
+
+				auto* curl = transfer->curl;
+				setup_handle(curl, transfer->url, transfer->header_list);
+				curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, transfer_write_callback);
+				curl_easy_setopt(curl, CURLOPT_WRITEDATA, transfer.get());
+				curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer.get());
+
+				if (!transfer->options.range.empty())
+				{
+					curl_easy_setopt(curl, CURLOPT_RANGE, transfer->options.range.c_str());
+				}
+
+				// Wait for an existing connection to the same host to multiplex on instead of opening another one
+				curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+				curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+				curl_easy_setopt(curl, CURLOPT_STREAM_WEIGHT, get_stream_weight(transfer->options.priority));
+
+				curl_multi_add_handle(this->multi_, curl);
+				this->active_.emplace(transfer->id, std::move(transfer));
+			}
+
+			void finish(const request_id id, const bool success)
+			{
+				const auto entry = this->active_.find(id);
+				if (entry == this->active_.end())
+				{
+					return;
+				}
+
+				auto transfer = std::move(entry->second);
+				this->active_.erase(entry);
+
+				{
+					std::lock_guard _(this->mutex_);
+					this->running_ids_.erase(id);
+					this->cancelled_ids_.erase(id);
+				}
+
+				curl_multi_remove_handle(this->multi_, transfer->curl);
+				get_client().record_timings(transfer->curl);
+				get_client().release(transfer->curl);
+				curl_slist_free_all(transfer->header_list);
+
+				if (success)
+				{
+					transfer->callback(std::move(transfer->buffer));
+				}
+				else
+				{
+					transfer->callback({});
+				}
+			}
+
+			// Returns whether transfers are still paused
+			bool resume_paused()
+			{
+				const auto can_resume = get_rate_limiter().get_wait_time().count() == 0;
+
+				auto paused = false;
+				for (const auto& transfer : this->active_ | std::views::values)
+				{
+					if (transfer->paused && can_resume)
+					{
+						// Delivers the held back data right away, which may pause the transfer again
+						transfer->paused = false;
+						curl_easy_pause(transfer->curl, CURLPAUSE_CONT);
+					}
+
+					paused |= transfer->paused;
+				}
+
+				return paused;
+			}
+
+			void run()
+			{
+				while (true)
+				{
+					std::vector<std::unique_ptr<transfer>> starting;
+					std::vector<std::unique_ptr<transfer>> cancelled;
+					std::vector<request_id> cancelling;
+
+					{
+						std::lock_guard _(this->mutex_);
+						if (this->stopping_)
+						{
+							break;
+						}
+
+						cancelled.swap(this->cancelled_queued_);
+						cancelling.assign(this->cancelled_ids_.begin(), this->cancelled_ids_.end());
+
+						// Highest priority first, in the order the requests came in
+						auto available = MAX_ACTIVE_TRANSFERS - std::min(MAX_ACTIVE_TRANSFERS, this->active_.size());
+						for (auto i = std::size(this->queues_); i-- > 0 && available > 0;)
+						{
+							auto& queue = this->queues_[i];
+							while (!queue.empty() && available > 0)
+							{
+								this->running_ids_.emplace(queue.front()->id);
+								starting.emplace_back(std::move(queue.front()));
+								queue.pop_front();
+								--available;
+							}
+						}
+					}
+
+					for (const auto& transfer : cancelled)
+					{
+						transfer->callback({});
+					}
+
+					for (const auto id : cancelling)
+					{
+						this->finish(id, false);
+					}
+
+					for (auto& transfer : starting)
+					{
+						this->start(std::move(transfer));
+					}
+
+					auto running = 0;
+					curl_multi_perform(this->multi_, &running);
+
+					CURLMsg* msg;
+					auto queued = 0;
+					while ((msg = curl_multi_info_read(this->multi_, &queued)))
+					{
+						if (msg->msg != CURLMSG_DONE)
+						{
+							continue;
+						}
+
+						transfer* transfer = nullptr;
+						curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &transfer);
+						this->finish(transfer->id, msg->data.result == CURLE_OK);
+					}
+
+					curl_multi_poll(this->multi_, nullptr, 0, get_poll_timeout(this->resume_paused()), nullptr);
+				}
+
+				// Nobody is going to wait for these anymore, but every callback must be invoked exactly once
+				while (!this->active_.empty())
+				{
+					this->finish(this->active_.begin()->first, false);
+				}
+
+				std::vector<std::unique_ptr<transfer>> remaining;
+
+				{
+					std::lock_guard _(this->mutex_);
+					remaining.swap(this->cancelled_queued_);
+
+					for (auto& queue : this->queues_)
+					{
+						std::move(queue.begin(), queue.end(), std::back_inserter(remaining));
+						queue.clear();
+					}
+				}
+
+				for (const auto& transfer : remaining)
+				{
+					transfer->callback({});
+				}
+			}
+		};
+
+		engine& get_engine()
 		{
-			static_cast<std::string*>(userp)->append(static_cast<char*>(contents), size * nmemb);
-			return size * nmemb;
+			static engine engine;
+			return engine;
+		}
+
+		// Picks the active segment that is expected to finish last, based on its current speed
+		segment* find_slowest_segment(const std::vector<std::unique_ptr<segment>>& segments)
+		{
+			segment* slowest = nullptr;
+			auto slowest_eta = 0.0;
+
+			for (const auto& segment : segments)
+			{
+				if (!segment->active || segment->end - segment->offset < MIN_SEGMENT_SIZE * 2)
+				{
+					continue;
+				}
+
+				curl_off_t speed = 0;
+				curl_easy_getinfo(segment->curl, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+
+				const auto eta = static_cast<double>(segment->end - segment->offset) / static_cast<double>(std::max<curl_off_t>(speed, 1));
+				if (!slowest || eta > slowest_eta)
+				{
+					slowest = segment.get();
+					slowest_eta = eta;
+				}
+			}
+
+			return slowest;
 		}
 	}
 
 	std::optional<std::string> get_data(const std::string& url, const headers& headers)
 	{
-		curl_slist* header_list = nullptr;
-		auto* curl = curl_easy_init();
+		const easy_handle handle{};
+		auto* curl = handle.get();
 		if (!curl)
 		{
 			return {};
 		}
 
+		auto* header_list = build_header_list(headers);
 		auto _ = gsl::finally([&]()
 		{
 			curl_slist_free_all(header_list);
-			curl_easy_cleanup(curl);
 		});
 
-		
-		for(const auto& header : headers)
-		{
-			auto data = header.first + ": "s + header.second;
-			header_list = curl_slist_append(header_list, data.c_str());
-		}
-		
 		std::string buffer{};
-		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header_list);
-		curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+		setup_handle(curl, url, header_list);
 		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
 		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buffer);
-		curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-		curl_easy_setopt(curl, CURLOPT_USERAGENT, "aw-installer/1.0");
-		curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
 
-		if (curl_easy_perform(curl) == CURLE_OK)
+		if (handle.perform() == CURLE_OK)
 		{
 			return {std::move(buffer)};
 		}
@@ -55,11 +1448,627 @@ namespace utils::http
 		return {};
 	}
 
+	std::optional<response> get_data_conditional(const std::string& url, const std::string& etag, const std::string& last_modified, const headers& headers)
+	{
+		auto request_headers = headers;
+		if (!etag.empty())
+		{
+			request_headers["If-None-Match"] = etag;
+		}
+
+		if (!last_modified.empty())
+		{
+			request_headers["If-Modified-Since"] = last_modified;
+		}
+
+		const easy_handle handle{};
+		auto* curl = handle.get();
+		if (!curl)
+		{
+			return {};
+		}
+
+		auto* header_list = build_header_list(request_headers);
+		auto _ = gsl::finally([&]()
+		{
+			curl_slist_free_all(header_list);
+		});
+
+		file_info info{};
+		std::string buffer{};
+		setup_handle(curl, url, header_list);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buffer);
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, file_info_header_callback);
+		curl_easy_setopt(curl, CURLOPT_HEADERDATA, &info);
+
+		if (handle.perform() != CURLE_OK)
+		{
+			return {};
+		}
+
+		response response{};
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response.status);
+		response.data = std::move(buffer);
+		response.etag = std::move(info.etag);
+		response.last_modified = std::move(info.last_modified);
+
+		return {std::move(response)};
+	}
+
+	timings get_timings()
+	{
+		return get_client().get_timings();
+	}
+
+	void set_rate_limit(const std::uint64_t bytes_per_second)
+	{
+		get_rate_limiter().set_rate(bytes_per_second);
+	}
+
+	std::uint64_t get_rate_limit()
+	{
+		return get_rate_limiter().get_rate();
+	}
+
 	std::future<std::optional<std::string>> get_data_async(const std::string& url, const headers& headers)
 	{
-		return std::async(std::launch::async, [url, headers]() -> std::optional<std::string>
+		auto promise = std::make_shared<std::promise<std::optional<std::string>>>();
+		auto future = promise->get_future();
+
+		request_options options{};
+		options.headers = headers;
+
+		get_data_async(url, [promise](std::optional<std::string>&& data)
+		{
+			promise->set_value(std::move(data));
+		}, options);
+
+		return future;
+	}
+
+	request_id get_data_async(const std::string& url, completion_callback callback, const request_options& options)
+	{
+		return get_engine().submit(url, options, std::move(callback));
+	}
+
+	bool cancel(const request_id id)
+	{
+		return get_engine().cancel(id);
+	}
+
+	bool download_file(const std::string& url, const std::filesystem::path& file, const download_options& options)
+	{
+		io::file_writer writer(file);
+		if (!writer.is_open())
+		{
+			return false;
+		}
+
+		const easy_handle handle{};
+		auto* curl = handle.get();
+		if (!curl)
+		{
+			return false;
+		}
+
+		auto* header_list = build_header_list(options.headers);
+		auto _ = gsl::finally([&]()
+		{
+			curl_slist_free_all(header_list);
+		});
+
+		sha256 hash{};
+
+		download_context context{};
+		context.curl = curl;
+		context.writer = &writer;
+		context.options = &options;
+		context.hash = options.sha256 ? &hash : nullptr;
+
+		setup_handle(curl, url, header_list);
+		setup_cancellation(curl, options);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, file_write_callback);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &context);
+
+		if (handle.perform() != CURLE_OK || !context.flush())
+		{
+			return false;
+		}
+
+		if (options.sha256)
+		{
+			*options.sha256 = hash.finish_hex();
+		}
+
+		return true;
+	}
+
+	std::optional<file_info> get_file_info(const std::string& url, const headers& headers)
+	{
+		const easy_handle handle{};
+		auto* curl = handle.get();
+		if (!curl)
+		{
+			return {};
+		}
+
+		auto* header_list = build_header_list(headers);
+		auto _ = gsl::finally([&]()
+		{
+			curl_slist_free_all(header_list);
+		});
+
+		file_info info{};
+		setup_handle(curl, url, header_list);
+		curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, file_info_header_callback);
+		curl_easy_setopt(curl, CURLOPT_HEADERDATA, &info);
+
+		if (handle.perform() != CURLE_OK)
+		{
+			return {};
+		}
+
+		curl_off_t content_length = -1;
+		if (curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length) == CURLE_OK && content_length > 0)
+		{
+			info.size = static_cast<std::uint64_t>(content_length);
+		}
+
+		const char* effective_url = nullptr;
+		curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective_url);
+		info.effective_url = effective_url ? effective_url : url;
+
+		return {std::move(info)};
+	}
+
+	bool download_file_segmented(const std::vector<std::string>& urls, const std::filesystem::path& file, const download_options& options)
+	{
+		std::vector<source> sources;
+		sources.reserve(urls.size());
+
+		for (const auto& url : urls)
+		{
+			sources.emplace_back().url = url;
+		}
+
+		auto previous_state = load_resume_state(file);
+		if (previous_state.has_value())
+		{
+			// Stay with the source the partial download came from, other sources have other validators
+			const auto entry = std::find_if(sources.begin(), sources.end(), [&](const auto& source)
+			{
+				return source.url == previous_state->url;
+			});
+
+			if (entry != sources.end())
+			{
+				std::rotate(sources.begin(), entry, entry + 1);
+			}
+		}
+
+		CURLM* multi = nullptr;
+		std::vector<std::unique_ptr<segment>> segments;
+
+		auto _ = gsl::finally([&]()
+		{
+			for (const auto& segment : segments)
+			{
+				if (segment->curl)
+				{
+					curl_multi_remove_handle(multi, segment->curl);
+					get_client().release(segment->curl);
+				}
+			}
+
+			if (multi)
+			{
+				curl_multi_cleanup(multi);
+			}
+
+			for (const auto& source : sources)
+			{
+				curl_slist_free_all(source.header_list);
+			}
+		});
+
+		// The first usable source describes the file
+		auto primary = sources.size();
+		for (std::size_t i = 0; i < sources.size(); ++i)
+		{
+			if (prepare_source(sources[i], options.headers, 0))
+			{
+				primary = i;
+				break;
+			}
+		}
+
+		if (primary == sources.size())
+		{
+			// Nobody can do ranged requests, try the sources one after another with a single stream
+			remove_resume_state(file);
+			return std::any_of(sources.begin(), sources.end(), [&](const auto& source)
+			{
+				return download_file(source.url, file, options);
+			});
+		}
+
+		const auto& info = *sources[primary].info;
+		const auto detect_stalls = sources.size() > 1;
+
+		resume_state state{};
+		state.url = sources[primary].url;
+		state.etag = info.etag;
+		state.last_modified = info.last_modified;
+		state.size = info.size;
+
+		auto resuming = false;
+		if (previous_state.has_value() && can_resume(*previous_state, state.url, info, file))
+		{
+			state.pending = std::move(previous_state->pending);
+			resuming = true;
+		}
+
+		io::file_writer writer(file, resuming);
+		if (!writer.is_open())
+		{
+			return false;
+		}
+
+		if (!resuming)
+		{
+			writer.preallocate(info.size);
+		}
+
+		// Every connection holds a buffer from the pool
+		const auto connections = std::clamp<std::size_t>(std::min({options.connections, DOWNLOAD_BUFFER_COUNT, static_cast<std::size_t>(info.size / MIN_SEGMENT_SIZE)}), 1, DOWNLOAD_BUFFER_COUNT);
+
+		stream_feeder feeder(file, options);
+
+		std::deque<byte_range> queue(state.pending.begin(), state.pending.end());
+		if (resuming && feeder.is_streaming())
+		{
+			// Connections work through the file front to back
+			auto ranges = std::move(state.pending);
+			std::sort(ranges.begin(), ranges.end());
+
+			queue.clear();
+			for (const auto& [begin, end] : ranges)
+			{
+				for (auto offset = begin; offset < end; offset += STREAM_RANGE_SIZE)
+				{
+					queue.emplace_back(offset, std::min(end, offset + STREAM_RANGE_SIZE));
+				}
+			}
+		}
+		else if (!resuming)
+		{
+			// Whole rounds of pieces, so no connection sits idle while the others fetch the last ones
+			const auto piece_count = feeder.is_streaming()
+				                         ? std::max<std::uint64_t>(info.size / STREAM_RANGE_SIZE / connections, 1) * connections
+				                         : connections;
+
+			const auto piece_size = info.size / piece_count;
+			for (std::uint64_t i = 0; i < piece_count; ++i)
+			{
+				queue.emplace_back(piece_size * i, i + 1 == piece_count ? info.size : piece_size * (i + 1));
+			}
+		}
+
+		multi = curl_multi_init();
+		if (!multi)
+		{
+			return false;
+		}
+
+		segments.reserve(connections);
+
+		// Only bytes that reached the file count as received
+		const auto save_state = [&]()
+		{
+			state.pending.assign(queue.begin(), queue.end());
+			for (const auto& segment : segments)
+			{
+				if (!segment->is_complete() || segment->buffered)
+				{
+					state.pending.emplace_back(segment->offset - segment->buffered, segment->end);
+				}
+			}
+
+			save_resume_state(file, state);
+		};
+
+		const auto fail = [&]()
+		{
+			for (const auto& segment : segments)
+			{
+				segment->flush();
+			}
+
+			save_state();
+			return false;
+		};
+
+		// Everything in front of the first missing byte is in the file
+		const auto written_until = [&]()
+		{
+			auto until = info.size;
+			for (const auto& range : queue)
+			{
+				until = std::min(until, range.first);
+			}
+
+			for (const auto& segment : segments)
+			{
+				if (!segment->is_complete() || segment->buffered)
+				{
+					until = std::min(until, segment->offset - segment->buffered);
+				}
+			}
+
+			return until;
+		};
+
+		const auto next_range = [&](struct segment& segment)
+		{
+			const auto [begin, end] = queue.front();
+			queue.pop_front();
+
+			segment.offset = begin;
+			segment.end = end;
+			segment.retries = 0;
+		};
+
+		// Moves the segment to the next usable source, possibly the one it is already on
+		const auto switch_source = [&](struct segment& segment)
+		{
+			for (std::size_t i = 1; i <= sources.size(); ++i)
+			{
+				const auto index = (segment.source + i) % sources.size();
+				if (prepare_source(sources[index], options.headers, info.size))
+				{
+					segment.source = index;
+					return true;
+				}
+			}
+
+			return false;
+		};
+
+		const auto start = [&](struct segment& segment)
+		{
+			start_segment(multi, segment, sources[segment.source], options, detect_stalls);
+		};
+
+		for (std::size_t i = 0; i < connections && !queue.empty(); ++i)
+		{
+			auto segment = std::make_unique<struct segment>();
+			segment->writer = &writer;
+			segment->buffer = std::make_unique<download_buffer>();
+			segment->source = primary;
+			next_range(*segment);
+
+			start(*segment);
+			segments.emplace_back(std::move(segment));
+		}
+
+		save_state();
+		auto last_save = std::chrono::steady_clock::now();
+
+		const auto cancelled = [&]()
+		{
+			remove_resume_state(file);
+			return false;
+		};
+
+		auto active = segments.size();
+		while (active > 0)
+		{
+			if (is_cancelled(options))
+			{
+				return cancelled();
+			}
+
+			auto running = 0;
+			if (curl_multi_perform(multi, &running) != CURLM_OK)
+			{
+				return fail();
+			}
+
+			CURLMsg* msg;
+			auto queued = 0;
+			while ((msg = curl_multi_info_read(multi, &queued)))
+			{
+				if (msg->msg != CURLMSG_DONE)
+				{
+					continue;
+				}
+
+				struct segment* segment = nullptr;
+				curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &segment);
+				curl_multi_remove_handle(multi, msg->easy_handle);
+				get_client().record_timings(msg->easy_handle);
+				segment->active = false;
+
+				if (msg->data.result == CURLE_ABORTED_BY_CALLBACK)
+				{
+					return cancelled();
+				}
+
+				// Neither a rejected range nor a broken connection, the file can't be written
+				if (segment->write_failed || !segment->flush())
+				{
+					return fail();
+				}
+
+				if (segment->rejected)
+				{
+					if (segment->source == primary)
+					{
+						// The remote file changed, what we have so far is useless
+						remove_resume_state(file);
+						return false;
+					}
+
+					// A mirror that does not serve the same file is of no use
+					sources[segment->source].failed = true;
+					if (!switch_source(*segment))
+					{
+						return fail();
+					}
+
+					start(*segment);
+					continue;
+				}
+
+				if (!segment->is_complete())
+				{
+					// Only give up on connections that make no progress at all
+					if (segment->offset > segment->requested)
+					{
+						segment->retries = 0;
+					}
+
+					if (++segment->retries > MAX_SEGMENT_RETRIES)
+					{
+						return fail();
+					}
+
+					if (msg->data.result == CURLE_OPERATION_TIMEDOUT && detect_stalls && !switch_source(*segment))
+					{
+						return fail();
+					}
+
+					start(*segment);
+					continue;
+				}
+
+				if (!queue.empty())
+				{
+					next_range(*segment);
+					start(*segment);
+					continue;
+				}
+
+				// Help out with the tail of the slowest segment instead of idling
+				if (auto* slowest = find_slowest_segment(segments))
+				{
+					const auto middle = slowest->offset + (slowest->end - slowest->offset) / 2;
+
+					segment->offset = middle;
+					segment->end = slowest->end;
+					segment->retries = 0;
+					slowest->end = middle;
+
+					start(*segment);
+					continue;
+				}
+
+				--active;
+			}
+
+			feeder.advance(written_until());
+			if (feeder.has_failed())
+			{
+				return fail();
+			}
+
+			if (const auto now = std::chrono::steady_clock::now(); now - last_save >= RESUME_SAVE_INTERVAL)
+			{
+				save_state();
+				last_save = now;
+			}
+
+			const auto can_resume = get_rate_limiter().get_wait_time().count() == 0;
+
+			auto paused = false;
+			for (const auto& segment : segments)
+			{
+				if (segment->active && segment->paused && can_resume)
+				{
+					segment->paused = false;
+					curl_easy_pause(segment->curl, CURLPAUSE_CONT);
+				}
+
+				paused |= segment->active && segment->paused;
+			}
+
+			if (active > 0 && curl_multi_poll(multi, nullptr, 0, get_poll_timeout(paused), nullptr) != CURLM_OK)
+			{
+				return fail();
+			}
+		}
+
+		feeder.advance(written_until());
+		if (!feeder.finish())
+		{
+			return fail();
+		}
+
+		remove_resume_state(file);
+		return true;
+	}
+
+	std::vector<std::string> rank_sources(const std::vector<std::string>& urls, const std::size_t probe_size)
+	{
+		struct probe
+		{
+			std::string url;
+			double throughput = 0.0;
+		};
+
+		std::vector<probe> probes(urls.size());
+		std::vector<std::future<void>> results;
+		results.reserve(urls.size());
+
+		// An empty range would wrap around and probe the whole file, and a max_size of 0 does not limit anything
+		const auto size = std::max<std::size_t>(probe_size, 1);
+
+		request_options options{};
+		options.priority = priority::high;
+		options.range = "0-" + std::to_string(size - 1);
+		options.max_size = size;
+
+		for (std::size_t i = 0; i < urls.size(); ++i)
+		{
+			auto promise = std::make_shared<std::promise<void>>();
+			results.emplace_back(promise->get_future());
+
+			auto* probe = &probes[i];
+			probe->url = urls[i];
+
+			const auto start = std::chrono::steady_clock::now();
+			get_data_async(urls[i], [promise, probe, start](std::optional<std::string>&& data)
+			{
+				if (data.has_value() && !data->empty())
+				{
+					const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+					probe->throughput = static_cast<double>(data->size()) / std::max(elapsed, 1e-6);
+				}
+
+				promise->set_value();
+			}, options);
+		}
+
+		for (auto& result : results)
 		{
-			return get_data(url, headers);
+			result.wait();
+		}
+
+		std::stable_sort(probes.begin(), probes.end(), [](const auto& a, const auto& b)
+		{
+			return a.throughput > b.throughput;
 		});
+
+		std::vector<std::string> ranked;
+		ranked.reserve(probes.size());
+
+		for (auto& probe : probes)
+		{
+			ranked.emplace_back(std::move(probe.url));
+		}
+
+		return ranked;
 	}
 }
@@ -1,14 +1,134 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
 #include <future>
 #include <optional>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace utils::http
 {
 	using headers = std::unordered_map<std::string, std::string>;
 
+	using request_id = std::uint64_t;
+	using completion_callback = std::function<void(std::optional<std::string>&& data)>;
+
+	enum class priority
+	{
+		low,
+		normal,
+		high,
+	};
+
+	struct request_options
+	{
+		http::headers headers;
+
+		// Decides which queued request starts first when the engine is busy, and the weight of the HTTP/2 stream
+		http::priority priority = http::priority::normal;
+
+		// Byte range in the format of CURLOPT_RANGE, e.g. "0-1023"
+		std::string range;
+
+		// Bigger responses are aborted, 0 means no limit. Guards against servers that ignore the range
+		std::size_t max_size = 0;
+	};
+
+	struct download_options
+	{
+		http::headers headers;
+
+		// Number of parallel ranged requests
+		std::size_t connections = 4;
+
+		// With more than one source, a connection that stays below stall_speed bytes per second
+		// for stall_time is moved to the next source
+		std::uint64_t stall_speed = 32 * 1024;
+		std::chrono::seconds stall_time{15};
+
+		// Setting this aborts the download. A cancelled download leaves no resume state behind
+		const std::atomic_bool* cancel = nullptr;
+
+		// Receives the body in order while it is downloaded, so it can be processed before the download is done.
+		// Segmented downloads read a range back from the file once everything in front of it has been written,
+		// and call this from a thread of their own, so a slow consumer never holds up the transfers.
+		// If the download has to start over, the body is passed on again from the start
+		std::function<void(const char* data, std::size_t size)> on_data;
+
+		// Receives the hex encoded SHA-256 of the file once the download succeeded. It is computed from the
+		// same in order stream as on_data, so the file is not read again just to hash it
+		std::string* sha256 = nullptr;
+	};
+
+	struct file_info
+	{
+		std::uint64_t size = 0;
+		bool accepts_ranges = false;
+		std::string effective_url;
+
+		// Validators, used to tell whether a partial download still matches the remote file
+		std::string etag;
+		std::string last_modified;
+	};
+
+	struct response
+	{
+		long status = 0;
+		std::string data;
+		std::string etag;
+		std::string last_modified;
+	};
+
+	// Accumulated over every request made by this process
+	struct timings
+	{
+		std::size_t requests = 0;
+		std::size_t connections = 0; // Connections that had to be established, the rest were reused
+		std::chrono::microseconds dns{};
+		std::chrono::microseconds connect{};
+		std::chrono::microseconds tls{};
+	};
+
 	std::optional<std::string> get_data(const std::string& url, const headers& headers = {});
+
+	// Asynchronous requests all run on a single thread that drives one curl_multi handle.
+	// Callbacks are invoked on that thread and must not block
 	std::future<std::optional<std::string>> get_data_async(const std::string& url, const headers& headers = {});
+	request_id get_data_async(const std::string& url, completion_callback callback, const request_options& options = {});
+
+	// The callback of a cancelled request is invoked with an empty result. Returns false if the request already finished
+	bool cancel(request_id id);
+
+	// Sends If-None-Match/If-Modified-Since for the validators that are not empty.
+	// A 304 response means the cached copy is still valid, it comes without a body
+	std::optional<response> get_data_conditional(const std::string& url, const std::string& etag, const std::string& last_modified, const headers& headers = {});
+
+	timings get_timings();
+
+	// Caps the combined download speed of every transfer in the process. 0 removes the limit.
+	// Can be changed at any time, running transfers pick up the new value
+	void set_rate_limit(std::uint64_t bytes_per_second);
+	std::uint64_t get_rate_limit();
+
+	// Streams the response body straight into the file. Memory usage does not depend on the size of the download
+	bool download_file(const std::string& url, const std::filesystem::path& file, const download_options& options = {});
+
+	// Sends a HEAD request. Redirects are followed, effective_url is where the file actually lives
+	std::optional<file_info> get_file_info(const std::string& url, const headers& headers = {});
+
+	// Splits the download into HTTP Range requests spread over several connections. Each segment is written
+	// at its offset in the file. Falls back to download_file when no source supports ranges.
+	// All sources must serve the same file, the first one that answers is preferred. Progress is kept in a
+	// sidecar next to the file, an interrupted download continues where it stopped on the next call unless
+	// the remote file changed in the meantime
+	bool download_file_segmented(const std::vector<std::string>& urls, const std::filesystem::path& file, const download_options& options = {});
+
+	// Fetches the first probe_size bytes from every URL at the same time and orders them by throughput,
+	// fastest first. URLs that could not be probed end up at the back. At least one byte is probed, servers that
+	// answer with more than probe_size bytes count as failed
+	std::vector<std::string> rank_sources(const std::vector<std::string>& urls, std::size_t probe_size = 256 * 1024);
 }
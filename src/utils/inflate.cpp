@@ -0,0 +1,917 @@
+#include <std_include.hpp>
+
+#include "cpu.hpp"
+#include "inflate.hpp"
+
+#include <zlib.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define INFLATE_X86
+#endif
+
+#if defined(__clang__) || defined(__GNUC__)
+#define INFLATE_TARGET(features) __attribute__((target(features)))
+#define INFLATE_INLINE inline __attribute__((always_inline))
+#else
+#define INFLATE_TARGET(features)
+#define INFLATE_INLINE __forceinline
+#endif
+
+namespace utils::inflate
+{
+	namespace
+	{
+		static_assert(std::endian::native == std::endian::little, "The bit reader loads little endian words");
+
+		constexpr std::size_t WINDOW_SIZE = 32 * 1024;
+		constexpr std::size_t OUTPUT_CHUNK_SIZE = 1024 * 1024;
+		constexpr std::size_t MAX_MATCH_LENGTH = 258;
+
+		// Matches are copied in 16 byte pieces and may write up to 15 bytes past their end
+		constexpr std::size_t COPY_SLACK = 32;
+		constexpr std::size_t OUTPUT_BUFFER_SIZE = WINDOW_SIZE + OUTPUT_CHUNK_SIZE + MAX_MATCH_LENGTH + COPY_SLACK;
+
+		constexpr unsigned MAX_CODE_LENGTH = 15;
+		constexpr unsigned LITLEN_TABLE_BITS = 10;
+		constexpr unsigned DIST_TABLE_BITS = 8;
+		constexpr unsigned PRECODE_TABLE_BITS = 7;
+
+		constexpr unsigned LITLEN_SYMBOLS = 288;
+		constexpr unsigned DIST_SYMBOLS = 32;
+		constexpr unsigned PRECODE_SYMBOLS = 19;
+
+		// Every symbol gets at most one subtable, which is never bigger than the longest code allows
+		constexpr std::size_t LITLEN_TABLE_SIZE = (1u << LITLEN_TABLE_BITS) + LITLEN_SYMBOLS * (1u << (MAX_CODE_LENGTH - LITLEN_TABLE_BITS));
+		constexpr std::size_t DIST_TABLE_SIZE = (1u << DIST_TABLE_BITS) + DIST_SYMBOLS * (1u << (MAX_CODE_LENGTH - DIST_TABLE_BITS));
+		constexpr std::size_t PRECODE_TABLE_SIZE = 1u << PRECODE_TABLE_BITS;
+
+		// Table entries: value in bits 16-31, extra bits (or subtable bits) in 11-15, type in 8-10, code length in 0-7
+		enum entry_type : std::uint32_t
+		{
+			TYPE_LITERAL,
+			TYPE_BASE,
+			TYPE_END_OF_BLOCK,
+			TYPE_SUBTABLE,
+			TYPE_INVALID,
+		};
+
+		constexpr std::uint32_t make_entry(const std::uint32_t value, const entry_type type, const std::uint32_t extra = 0, const std::uint32_t bits = 0)
+		{
+			return (value << 16) | (extra << 11) | (static_cast<std::uint32_t>(type) << 8) | bits;
+		}
+
+		constexpr std::uint32_t get_bits(const std::uint32_t entry)
+		{
+			return entry & 0xFF;
+		}
+
+		constexpr entry_type get_type(const std::uint32_t entry)
+		{
+			return static_cast<entry_type>((entry >> 8) & 7);
+		}
+
+		constexpr std::uint32_t get_extra(const std::uint32_t entry)
+		{
+			return (entry >> 11) & 0x1F;
+		}
+
+		constexpr std::uint32_t get_value(const std::uint32_t entry)
+		{
+			return entry >> 16;
+		}
+
+		constexpr std::uint32_t INVALID_ENTRY = make_entry(0, TYPE_INVALID);
+
+		constexpr std::uint16_t LENGTH_BASE[] =
+		{
+			3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+		};
+
+		constexpr std::uint8_t LENGTH_EXTRA[] =
+		{
+			0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+		};
+
+		constexpr std::uint16_t DIST_BASE[] =
+		{
+			1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+			6145, 8193, 12289, 16385, 24577,
+		};
+
+		constexpr std::uint8_t DIST_EXTRA[] =
+		{
+			0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+		};
+
+		constexpr std::uint8_t PRECODE_ORDER[PRECODE_SYMBOLS] =
+		{
+			16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+		};
+
+		// What each symbol decodes to, the code length is added when the table is built
+		struct symbol_entries
+		{
+			std::uint32_t litlen[LITLEN_SYMBOLS];
+			std::uint32_t dist[DIST_SYMBOLS];
+			std::uint32_t precode[PRECODE_SYMBOLS];
+		};
+
+		constexpr symbol_entries make_symbol_entries()
+		{
+			symbol_entries entries{};
+
+			for (std::uint32_t i = 0; i < 256; ++i)
+			{
+				entries.litlen[i] = make_entry(i, TYPE_LITERAL);
+			}
+
+			entries.litlen[256] = make_entry(0, TYPE_END_OF_BLOCK);
+
+			for (std::uint32_t i = 0; i < std::size(LENGTH_BASE); ++i)
+			{
+				entries.litlen[257 + i] = make_entry(LENGTH_BASE[i], TYPE_BASE, LENGTH_EXTRA[i]);
+			}
+
+			entries.litlen[286] = entries.litlen[287] = INVALID_ENTRY;
+
+			for (std::uint32_t i = 0; i < std::size(DIST_BASE); ++i)
+			{
+				entries.dist[i] = make_entry(DIST_BASE[i], TYPE_BASE, DIST_EXTRA[i]);
+			}
+
+			entries.dist[30] = entries.dist[31] = INVALID_ENTRY;
+
+			for (std::uint32_t i = 0; i < PRECODE_SYMBOLS; ++i)
+			{
+				entries.precode[i] = make_entry(i, TYPE_LITERAL);
+			}
+
+			return entries;
+		}
+
+		constexpr auto SYMBOL_ENTRIES = make_symbol_entries();
+
+		enum class code_kind
+		{
+			precode,
+			litlen,
+			dist,
+		};
+
+		// Builds a lookup table for a canonical Huffman code the same way zlib's inflate_table does: codes longer than
+		// table_bits continue in subtables. Over-subscribed codes are rejected, so are incomplete ones unless they consist of
+		// a single code of length 1. A distance code without any codes is accepted, using it is an error
+		bool build_table(const std::uint8_t* lengths, const unsigned count, const std::uint32_t* entries, const code_kind kind,
+		                 const unsigned table_bits, std::uint32_t* table, const std::size_t table_size)
+		{
+			unsigned counts[MAX_CODE_LENGTH + 1]{};
+			for (unsigned i = 0; i < count; ++i)
+			{
+				++counts[lengths[i]];
+			}
+
+			unsigned max_length = MAX_CODE_LENGTH;
+			while (max_length > 0 && !counts[max_length])
+			{
+				--max_length;
+			}
+
+			std::fill(table, table + (1u << table_bits), INVALID_ENTRY);
+
+			if (!max_length)
+			{
+				return kind == code_kind::dist;
+			}
+
+			auto left = 1;
+			for (unsigned length = 1; length <= MAX_CODE_LENGTH; ++length)
+			{
+				left <<= 1;
+				left -= static_cast<int>(counts[length]);
+				if (left < 0)
+				{
+					return false;
+				}
+			}
+
+			if (left > 0 && (kind == code_kind::precode || max_length != 1))
+			{
+				return false;
+			}
+
+			unsigned offsets[MAX_CODE_LENGTH + 2]{};
+			for (unsigned length = 1; length <= MAX_CODE_LENGTH; ++length)
+			{
+				offsets[length + 1] = offsets[length] + counts[length];
+			}
+
+			std::uint16_t sorted[LITLEN_SYMBOLS];
+			for (unsigned symbol = 0; symbol < count; ++symbol)
+			{
+				if (lengths[symbol])
+				{
+					sorted[offsets[lengths[symbol]]++] = static_cast<std::uint16_t>(symbol);
+				}
+			}
+
+			const auto mask = (1u << table_bits) - 1;
+
+			auto* next = table;
+			std::size_t used = 1u << table_bits;
+
+			unsigned code = 0; // Bit reversed, deflate sends codes starting with the most significant bit
+			unsigned symbol = 0;
+			unsigned drop = 0;
+			unsigned current_bits = table_bits;
+			auto low = ~0u;
+
+			auto length = lengths[sorted[0]];
+			for (;;)
+			{
+				const auto entry = entries[sorted[symbol]] | (length - drop);
+
+				// Every index that ends with this code maps to it
+				const auto increment = 1u << (length - drop);
+				auto fill = 1u << current_bits;
+				const auto current_size = fill;
+				do
+				{
+					fill -= increment;
+					next[(code >> drop) + fill] = entry;
+				}
+				while (fill != 0);
+
+				// Increment the reversed code
+				auto bit = 1u << (length - 1);
+				while (code & bit)
+				{
+					bit >>= 1;
+				}
+
+				code = bit ? (code & (bit - 1)) + bit : 0;
+
+				++symbol;
+				if (--counts[length] == 0)
+				{
+					if (length == max_length)
+					{
+						break;
+					}
+
+					length = lengths[sorted[symbol]];
+				}
+
+				// Start a new subtable once the first table_bits bits of the code change
+				if (length > table_bits && (code & mask) != low)
+				{
+					if (!drop)
+					{
+						drop = table_bits;
+					}
+
+					next += current_size;
+
+					// Make the subtable just big enough for the codes that share its prefix
+					current_bits = length - drop;
+					auto remaining = 1 << current_bits;
+					while (current_bits + drop < max_length)
+					{
+						remaining -= static_cast<int>(counts[current_bits + drop]);
+						if (remaining <= 0)
+						{
+							break;
+						}
+
+						++current_bits;
+						remaining <<= 1;
+					}
+
+					used += 1u << current_bits;
+					if (used > table_size)
+					{
+						return false;
+					}
+
+					low = code & mask;
+					table[low] = make_entry(static_cast<std::uint32_t>(next - table), TYPE_SUBTABLE, current_bits, table_bits);
+				}
+			}
+
+			return true;
+		}
+
+		struct fixed_tables
+		{
+			std::uint32_t litlen[LITLEN_TABLE_SIZE];
+			std::uint32_t dist[DIST_TABLE_SIZE];
+		};
+
+		const fixed_tables& get_fixed_tables()
+		{
+			static const auto tables = []
+			{
+				auto result = std::make_unique<fixed_tables>();
+
+				std::uint8_t lengths[LITLEN_SYMBOLS];
+				std::fill(lengths, lengths + 144, 8);
+				std::fill(lengths + 144, lengths + 256, 9);
+				std::fill(lengths + 256, lengths + 280, 7);
+				std::fill(lengths + 280, lengths + 288, 8);
+				build_table(lengths, LITLEN_SYMBOLS, SYMBOL_ENTRIES.litlen, code_kind::litlen, LITLEN_TABLE_BITS, result->litlen, LITLEN_TABLE_SIZE);
+
+				std::fill(lengths, lengths + DIST_SYMBOLS, 5);
+				build_table(lengths, DIST_SYMBOLS, SYMBOL_ENTRIES.dist, code_kind::dist, DIST_TABLE_BITS, result->dist, DIST_TABLE_SIZE);
+
+				return result;
+			}();
+
+			return *tables;
+		}
+
+		// Decoder state that does not need to live in registers
+		struct decoder_state
+		{
+			std::uint32_t litlen[LITLEN_TABLE_SIZE];
+			std::uint32_t dist[DIST_TABLE_SIZE];
+			std::uint32_t precode[PRECODE_TABLE_SIZE];
+			std::uint8_t lengths[LITLEN_SYMBOLS + DIST_SYMBOLS];
+			std::uint8_t output[OUTPUT_BUFFER_SIZE];
+		};
+
+		// Keeps at least 56 bits buffered after every refill. Past the end of the input zeros are shifted in,
+		// consuming any of them means the stream is truncated
+		struct bit_reader
+		{
+			const std::uint8_t* in;
+			const std::uint8_t* in_end;
+			std::uint64_t buffer = 0;
+			unsigned count = 0;
+			unsigned overread = 0;
+
+			INFLATE_INLINE void refill()
+			{
+				if (this->in_end - this->in >= 8)
+				{
+					std::uint64_t word;
+					std::memcpy(&word, this->in, sizeof(word));
+
+					// Bits above count are already filled with the bytes that come next, so they can be ORed in again
+					this->buffer |= word << this->count;
+					this->in += (63 - this->count) >> 3;
+					this->count |= 56;
+					return;
+				}
+
+				while (this->count <= 56)
+				{
+					if (this->in < this->in_end)
+					{
+						this->buffer |= static_cast<std::uint64_t>(*this->in++) << this->count;
+					}
+					else
+					{
+						++this->overread;
+					}
+
+					this->count += 8;
+				}
+			}
+
+			[[nodiscard]] INFLATE_INLINE std::uint32_t peek(const unsigned bits) const
+			{
+				return static_cast<std::uint32_t>(this->buffer & ((1ull << bits) - 1));
+			}
+
+			INFLATE_INLINE void consume(const unsigned bits)
+			{
+				this->buffer >>= bits;
+				this->count -= bits;
+			}
+
+			INFLATE_INLINE std::uint32_t read(const unsigned bits)
+			{
+				const auto value = this->peek(bits);
+				this->consume(bits);
+				return value;
+			}
+
+			// More than a bit buffer full of zeros means there is no way the stream is valid
+			[[nodiscard]] INFLATE_INLINE bool is_overrun() const
+			{
+				return this->overread > sizeof(this->buffer) || (this->count >> 3) < this->overread;
+			}
+
+			// Hands the whole bytes that are still buffered back to the input
+			INFLATE_INLINE bool align_to_byte()
+			{
+				this->consume(this->count & 7);
+
+				const auto buffered = this->count >> 3;
+				if (buffered < this->overread)
+				{
+					return false;
+				}
+
+				this->in -= buffered - this->overread;
+				this->buffer = 0;
+				this->count = 0;
+				this->overread = 0;
+				return true;
+			}
+
+			INFLATE_INLINE std::uint32_t decode(const std::uint32_t* table, const unsigned table_bits)
+			{
+				auto entry = table[this->peek(table_bits)];
+				if (get_type(entry) == TYPE_SUBTABLE)
+				{
+					this->consume(table_bits);
+					entry = table[get_value(entry) + this->peek(get_extra(entry))];
+				}
+
+				this->consume(get_bits(entry));
+				return entry;
+			}
+		};
+
+		// Copies length bytes from distance bytes back. Overlapping copies repeat the pattern, like deflate expects
+		INFLATE_INLINE void copy_match(std::uint8_t* out, const std::size_t distance, const std::size_t length)
+		{
+			const auto* src = out - distance;
+			auto* const end = out + length;
+
+			if (distance >= 16)
+			{
+				do
+				{
+					std::memcpy(out, src, 16);
+					out += 16;
+					src += 16;
+				}
+				while (out < end);
+			}
+			else if (distance >= 8)
+			{
+				do
+				{
+					std::memcpy(out, src, 8);
+					out += 8;
+					src += 8;
+				}
+				while (out < end);
+			}
+			else if (distance == 1)
+			{
+				std::memset(out, *src, length);
+			}
+			else
+			{
+				while (out < end)
+				{
+					*out++ = *src++;
+				}
+			}
+		}
+
+		class output_window
+		{
+		public:
+			output_window(std::uint8_t* buffer, const sink& output)
+				: buffer_(buffer)
+				, output_(output)
+				, out_(buffer)
+				, flushed_(buffer)
+			{
+			}
+
+			[[nodiscard]] INFLATE_INLINE std::uint8_t*& position()
+			{
+				return this->out_;
+			}
+
+			[[nodiscard]] INFLATE_INLINE std::size_t history() const
+			{
+				return static_cast<std::size_t>(this->out_ - this->buffer_);
+			}
+
+			[[nodiscard]] INFLATE_INLINE std::size_t space() const
+			{
+				return static_cast<std::size_t>(this->buffer_ + OUTPUT_BUFFER_SIZE - COPY_SLACK - this->out_);
+			}
+
+			// Makes sure the longest match fits
+			INFLATE_INLINE bool reserve()
+			{
+				return this->space() >= MAX_MATCH_LENGTH || this->slide();
+			}
+
+			// Passes the new data on and keeps the last 32 KiB, matches may still refer to them
+			bool slide()
+			{
+				if (!this->flush())
+				{
+					return false;
+				}
+
+				const auto keep = std::min(WINDOW_SIZE, this->history());
+				std::memmove(this->buffer_, this->out_ - keep, keep);
+
+				this->out_ = this->buffer_ + keep;
+				this->flushed_ = this->out_;
+				return true;
+			}
+
+			bool flush()
+			{
+				if (this->out_ == this->flushed_)
+				{
+					return true;
+				}
+
+				const auto* data = this->flushed_;
+				this->flushed_ = this->out_;
+				return this->output_(data, static_cast<std::size_t>(this->out_ - data));
+			}
+
+		private:
+			std::uint8_t* buffer_;
+			const sink& output_;
+			std::uint8_t* out_;
+			std::uint8_t* flushed_;
+		};
+
+		INFLATE_INLINE bool read_dynamic_tables(bit_reader& reader, decoder_state& state)
+		{
+			reader.refill();
+			const auto litlen_count = reader.read(5) + 257;
+			const auto dist_count = reader.read(5) + 1;
+			const auto precode_count = reader.read(4) + 4;
+
+			if (litlen_count > 286 || dist_count > 30)
+			{
+				return false;
+			}
+
+			std::uint8_t precode_lengths[PRECODE_SYMBOLS]{};
+			for (unsigned i = 0; i < precode_count; ++i)
+			{
+				reader.refill();
+				precode_lengths[PRECODE_ORDER[i]] = static_cast<std::uint8_t>(reader.read(3));
+			}
+
+			if (!build_table(precode_lengths, PRECODE_SYMBOLS, SYMBOL_ENTRIES.precode, code_kind::precode, PRECODE_TABLE_BITS, state.precode, PRECODE_TABLE_SIZE))
+			{
+				return false;
+			}
+
+			auto* lengths = state.lengths;
+			const auto total = litlen_count + dist_count;
+
+			for (unsigned i = 0; i < total;)
+			{
+				reader.refill();
+				if (reader.is_overrun())
+				{
+					return false;
+				}
+
+				const auto symbol = get_value(reader.decode(state.precode, PRECODE_TABLE_BITS));
+				if (symbol < 16)
+				{
+					lengths[i++] = static_cast<std::uint8_t>(symbol);
+					continue;
+				}
+
+				std::uint8_t value = 0;
+				unsigned repeat;
+				if (symbol == 16)
+				{
+					if (!i)
+					{
+						return false;
+					}
+
+					value = lengths[i - 1];
+					repeat = 3 + reader.read(2);
+				}
+				else if (symbol == 17)
+				{
+					repeat = 3 + reader.read(3);
+				}
+				else
+				{
+					repeat = 11 + reader.read(7);
+				}
+
+				if (repeat > total - i)
+				{
+					return false;
+				}
+
+				std::memset(lengths + i, value, repeat);
+				i += repeat;
+			}
+
+			// A block that can't end is invalid
+			if (!lengths[256])
+			{
+				return false;
+			}
+
+			return build_table(lengths, litlen_count, SYMBOL_ENTRIES.litlen, code_kind::litlen, LITLEN_TABLE_BITS, state.litlen, LITLEN_TABLE_SIZE)
+				&& build_table(lengths + litlen_count, dist_count, SYMBOL_ENTRIES.dist, code_kind::dist, DIST_TABLE_BITS, state.dist, DIST_TABLE_SIZE);
+		}
+
+		INFLATE_INLINE bool copy_stored_block(bit_reader& reader, output_window& window)
+		{
+			if (!reader.align_to_byte() || reader.in_end - reader.in < 4)
+			{
+				return false;
+			}
+
+			const auto* header = reader.in;
+			const auto length = static_cast<std::size_t>(header[0] | (header[1] << 8));
+			const auto inverted = static_cast<std::size_t>(header[2] | (header[3] << 8));
+			if (length != (~inverted & 0xFFFF))
+			{
+				return false;
+			}
+
+			reader.in += 4;
+			if (static_cast<std::size_t>(reader.in_end - reader.in) < length)
+			{
+				return false;
+			}
+
+			auto remaining = length;
+			while (remaining > 0)
+			{
+				if (!window.space() && !window.slide())
+				{
+					return false;
+				}
+
+				const auto chunk = std::min(remaining, window.space());
+				std::memcpy(window.position(), reader.in, chunk);
+
+				window.position() += chunk;
+				reader.in += chunk;
+				remaining -= chunk;
+			}
+
+			return true;
+		}
+
+		// One symbol per iteration. A refill always leaves at least 56 bits, enough for the longest
+		// length code, its extra bits, the longest distance code and its extra bits (15 + 5 + 15 + 13)
+		INFLATE_INLINE bool decode_block(bit_reader& reader, output_window& window, const std::uint32_t* litlen, const std::uint32_t* dist)
+		{
+			for (;;)
+			{
+				if (!window.reserve())
+				{
+					return false;
+				}
+
+				reader.refill();
+				if (reader.is_overrun())
+				{
+					return false;
+				}
+
+				auto& out = window.position();
+				const auto entry = reader.decode(litlen, LITLEN_TABLE_BITS);
+				const auto type = get_type(entry);
+
+				if (type == TYPE_LITERAL)
+				{
+					*out++ = static_cast<std::uint8_t>(get_value(entry));
+					continue;
+				}
+
+				if (type == TYPE_END_OF_BLOCK)
+				{
+					return true;
+				}
+
+				if (type != TYPE_BASE)
+				{
+					return false;
+				}
+
+				const auto length = get_value(entry) + reader.read(get_extra(entry));
+
+				const auto dist_entry = reader.decode(dist, DIST_TABLE_BITS);
+				if (get_type(dist_entry) != TYPE_BASE)
+				{
+					return false;
+				}
+
+				const auto distance = get_value(dist_entry) + reader.read(get_extra(dist_entry));
+				if (distance > window.history())
+				{
+					return false;
+				}
+
+				copy_match(out, distance, length);
+				out += length;
+			}
+		}
+
+		// The state is over a megabyte, allocating it for every small entry costs more than inflating the entry
+		thread_local std::unique_ptr<decoder_state> cached_state{};
+
+		std::unique_ptr<decoder_state> acquire_state()
+		{
+			if (cached_state)
+			{
+				return std::move(cached_state);
+			}
+
+			// Every table and the window are written before they are read
+			return std::make_unique_for_overwrite<decoder_state>();
+		}
+
+		void release_state(std::unique_ptr<decoder_state> state)
+		{
+			cached_state = std::move(state);
+		}
+
+		INFLATE_INLINE bool inflate_stream(const std::span<const std::byte> input, const sink& output, std::size_t* consumed)
+		{
+			// A sink inflating another stream gets a state of its own
+			auto state = acquire_state();
+			const auto _ = gsl::finally([&]
+			{
+				release_state(std::move(state));
+			});
+
+			const auto* begin = reinterpret_cast<const std::uint8_t*>(input.data());
+			bit_reader reader{begin, begin + input.size()};
+			output_window window(state->output, output);
+
+			auto final_block = false;
+			while (!final_block)
+			{
+				reader.refill();
+				final_block = reader.read(1);
+
+				auto result = false;
+				switch (reader.read(2))
+				{
+				case 0:
+					result = copy_stored_block(reader, window);
+					break;
+				case 1:
+					result = decode_block(reader, window, get_fixed_tables().litlen, get_fixed_tables().dist);
+					break;
+				case 2:
+					result = read_dynamic_tables(reader, *state) && decode_block(reader, window, state->litlen, state->dist);
+					break;
+				default:
+					break;
+				}
+
+				if (!result || reader.is_overrun())
+				{
+					return false;
+				}
+			}
+
+			// The stream ends at the next byte boundary
+			if (!reader.align_to_byte() || !window.flush())
+			{
+				return false;
+			}
+
+			if (consumed)
+			{
+				*consumed = static_cast<std::size_t>(reader.in - begin);
+			}
+
+			return true;
+		}
+
+		bool inflate_generic(const std::span<const std::byte> input, const sink& output, std::size_t* consumed)
+		{
+			return inflate_stream(input, output, consumed);
+		}
+
+#ifdef INFLATE_X86
+		// Variable shifts and masks are single instructions with BMI2, the bit reader uses them all the time
+		INFLATE_TARGET("bmi2")
+		bool inflate_bmi2(const std::span<const std::byte> input, const sink& output, std::size_t* consumed)
+		{
+			return inflate_stream(input, output, consumed);
+		}
+#endif
+
+		bool inflate_zlib(const std::span<const std::byte> input, const sink& output, std::size_t* consumed)
+		{
+			z_stream stream{};
+			if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+			{
+				return false;
+			}
+
+			const auto _ = gsl::finally([&stream]
+			{
+				inflateEnd(&stream);
+			});
+
+			const auto buffer = std::make_unique<std::uint8_t[]>(OUTPUT_CHUNK_SIZE);
+
+			const auto* in = reinterpret_cast<const Bytef*>(input.data());
+			auto remaining = input.size();
+
+			auto result = Z_OK;
+			while (result != Z_STREAM_END)
+			{
+				if (!stream.avail_in && remaining)
+				{
+					const auto chunk = std::min<std::size_t>(remaining, std::numeric_limits<uInt>::max());
+					stream.next_in = in;
+					stream.avail_in = static_cast<uInt>(chunk);
+					in += chunk;
+					remaining -= chunk;
+				}
+
+				stream.next_out = buffer.get();
+				stream.avail_out = static_cast<uInt>(OUTPUT_CHUNK_SIZE);
+
+				// Running out of input before the end of the stream means it is truncated
+				result = ::inflate(&stream, Z_NO_FLUSH);
+				if (result != Z_OK && result != Z_STREAM_END)
+				{
+					return false;
+				}
+
+				if (const auto produced = OUTPUT_CHUNK_SIZE - stream.avail_out; produced && !output(buffer.get(), produced))
+				{
+					return false;
+				}
+			}
+
+			if (consumed)
+			{
+				*consumed = input.size() - remaining - stream.avail_in;
+			}
+
+			return true;
+		}
+
+		// The best one for this CPU comes first
+		std::vector<backend> create_backends()
+		{
+			std::vector<backend> backends{};
+
+#ifdef INFLATE_X86
+			if (cpu::has_bmi2())
+			{
+				backends.push_back({"fast-bmi2", inflate_bmi2});
+			}
+#endif
+
+			backends.push_back({"fast", inflate_generic});
+			backends.push_back({"zlib", inflate_zlib});
+
+			return backends;
+		}
+
+		std::atomic<const backend*> selected_backend{nullptr};
+	}
+
+	const std::vector<backend>& get_backends()
+	{
+		static const auto backends = create_backends();
+		return backends;
+	}
+
+	const backend& get_backend()
+	{
+		if (const auto* backend = selected_backend.load())
+		{
+			return *backend;
+		}
+
+		return get_backends().front();
+	}
+
+	bool set_backend(const std::string& name)
+	{
+		for (const auto& backend : get_backends())
+		{
+			if (backend.name == name)
+			{
+				selected_backend = &backend;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool inflate_raw(const std::span<const std::byte> input, const sink& output, std::size_t* consumed)
+	{
+		return get_backend().inflate_raw(input, output, consumed);
+	}
+}
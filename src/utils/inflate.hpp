@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace utils::inflate
+{
+	// Receives the decompressed data in order. Returning false aborts the decompression
+	using sink = std::function<bool(const std::uint8_t* data, std::size_t size)>;
+
+	// Decompresses a raw deflate stream (RFC 1951) that is entirely in memory.
+	// consumed receives the size of the stream, whatever follows it is not touched
+	using inflate_function = bool(*)(std::span<const std::byte> input, const sink& output, std::size_t* consumed);
+
+	struct backend
+	{
+		const char* name;
+		inflate_function inflate_raw;
+	};
+
+	// Every backend produces the same output and rejects the same streams as zlib, they only differ in speed
+	const std::vector<backend>& get_backends();
+
+	// The backend picked for this CPU, unless set_backend chose another one
+	const backend& get_backend();
+	bool set_backend(const std::string& name);
+
+	bool inflate_raw(std::span<const std::byte> input, const sink& output, std::size_t* consumed = nullptr);
+}
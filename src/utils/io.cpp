@@ -125,12 +125,4 @@ namespace utils::io
 
 		return files;
 	}
-
-	void copy_folder(const std::filesystem::path& src, const std::filesystem::path& target)
-	{
-		std::error_code ec;
-		std::filesystem::copy(src, target,
-		                      std::filesystem::copy_options::overwrite_existing |
-		                      std::filesystem::copy_options::recursive, ec);
-	}
 }
@@ -17,5 +17,4 @@ namespace utils::io
 	bool directory_exists(const std::filesystem::path& directory);
 	bool directory_is_empty(const std::filesystem::path& directory);
 	std::vector<std::string> list_files(const std::filesystem::path& directory);
-	void copy_folder(const std::filesystem::path& src, const std::filesystem::path& target);
 }
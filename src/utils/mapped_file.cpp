@@ -0,0 +1,146 @@
+#include <std_include.hpp>
+
+#include "mapped_file.hpp"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace utils::io
+{
+	mapped_file::mapped_file(const std::filesystem::path& file)
+	{
+#ifdef _WIN32
+		const auto handle = CreateFileW(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		                                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			return;
+		}
+
+		const auto _ = gsl::finally([&handle]
+		{
+			CloseHandle(handle);
+		});
+
+		LARGE_INTEGER size{};
+		// Empty files can't be mapped
+		if (!GetFileSizeEx(handle, &size) || !size.QuadPart)
+		{
+			return;
+		}
+
+		this->mapping_ = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!this->mapping_)
+		{
+			return;
+		}
+
+		this->data_ = static_cast<const std::byte*>(MapViewOfFile(this->mapping_, FILE_MAP_READ, 0, 0, 0));
+		if (!this->data_)
+		{
+			this->close();
+			return;
+		}
+
+		this->size_ = static_cast<std::size_t>(size.QuadPart);
+#else
+		const auto fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+		{
+			return;
+		}
+
+		// The mapping stays valid after the descriptor is gone
+		const auto _ = gsl::finally([&fd]
+		{
+			::close(fd);
+		});
+
+		struct stat info{};
+		// Empty files can't be mapped
+		if (::fstat(fd, &info) != 0 || info.st_size <= 0)
+		{
+			return;
+		}
+
+		const auto size = static_cast<std::size_t>(info.st_size);
+		auto* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			return;
+		}
+
+#ifdef POSIX_MADV_SEQUENTIAL
+		::posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+#endif
+
+		this->data_ = static_cast<const std::byte*>(data);
+		this->size_ = size;
+#endif
+	}
+
+	mapped_file::~mapped_file()
+	{
+		this->close();
+	}
+
+	mapped_file::mapped_file(mapped_file&& obj) noexcept
+	{
+		this->operator=(std::move(obj));
+	}
+
+	mapped_file& mapped_file::operator=(mapped_file&& obj) noexcept
+	{
+		if (this != &obj)
+		{
+			this->close();
+
+#ifdef _WIN32
+			this->mapping_ = obj.mapping_;
+			obj.mapping_ = nullptr;
+#endif
+			this->data_ = obj.data_;
+			obj.data_ = nullptr;
+			this->size_ = obj.size_;
+			obj.size_ = 0;
+		}
+
+		return *this;
+	}
+
+	bool mapped_file::is_open() const
+	{
+		return this->data_ != nullptr;
+	}
+
+	std::span<const std::byte> mapped_file::data() const
+	{
+		return {this->data_, this->size_};
+	}
+
+	void mapped_file::close()
+	{
+#ifdef _WIN32
+		if (this->data_)
+		{
+			UnmapViewOfFile(this->data_);
+		}
+
+		if (this->mapping_)
+		{
+			CloseHandle(this->mapping_);
+			this->mapping_ = nullptr;
+		}
+#else
+		if (this->data_)
+		{
+			::munmap(const_cast<std::byte*>(this->data_), this->size_);
+		}
+#endif
+
+		this->data_ = nullptr;
+		this->size_ = 0;
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+namespace utils::io
+{
+	// Read-only view of a whole file. The mapping is shared by everyone reading from data(),
+	// nothing is copied until a page is actually touched
+	class mapped_file
+	{
+	public:
+		mapped_file() = default;
+		explicit mapped_file(const std::filesystem::path& file);
+		~mapped_file();
+
+		mapped_file(mapped_file&& obj) noexcept;
+		mapped_file& operator=(mapped_file&& obj) noexcept;
+
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+		[[nodiscard]] bool is_open() const;
+		[[nodiscard]] std::span<const std::byte> data() const;
+
+		void close();
+
+	private:
+#ifdef _WIN32
+		HANDLE mapping_ = nullptr;
+#endif
+		const std::byte* data_ = nullptr;
+		std::size_t size_ = 0;
+	};
+}
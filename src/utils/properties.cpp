@@ -12,11 +12,6 @@ namespace utils::properties
 {
 	namespace
 	{
-		std::string get_properties_file()
-		{
-			return "properties.json";
-		}
-
 		rapidjson::Document load_properties()
 		{
 			rapidjson::Document default_doc{};
@@ -54,6 +49,11 @@ namespace utils::properties
 		}
 	}
 
+	std::string get_properties_file()
+	{
+		return "properties.json";
+	}
+
 	std::optional<std::string> load(const std::string& name)
 	{
 		const auto doc = load_properties();
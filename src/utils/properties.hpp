@@ -5,6 +5,9 @@
 
 namespace utils::properties
 {
+	// Other state of the installer is kept next to this file
+	std::string get_properties_file();
+
 	std::optional<std::string> load(const std::string& name);
 	void store(const std::string& name, const std::string& value);
 }
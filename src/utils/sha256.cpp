@@ -0,0 +1,411 @@
+#include <std_include.hpp>
+
+#include "cpu.hpp"
+#include "sha256.hpp"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define SHA256_X86
+#include <immintrin.h>
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define SHA256_ARM64
+#include <arm_neon.h>
+#endif
+
+#if defined(__clang__) || defined(__GNUC__)
+#define SHA256_TARGET(features) __attribute__((target(features)))
+#define SHA256_INLINE inline __attribute__((always_inline))
+#else
+#define SHA256_TARGET(features)
+#define SHA256_INLINE __forceinline
+#endif
+
+namespace utils
+{
+	namespace
+	{
+		using kernel = void(*)(std::uint32_t state[8], const std::uint8_t* data, std::size_t blocks);
+
+		constexpr std::size_t BLOCK_SIZE = 64;
+
+		constexpr std::array<std::uint32_t, 8> INITIAL_STATE =
+		{
+			0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+		};
+
+		alignas(16) constexpr std::uint32_t K[64] =
+		{
+			0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+			0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+			0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+			0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+			0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+			0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+			0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+			0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+		};
+
+		std::uint32_t rotr(const std::uint32_t value, const int bits)
+		{
+			return (value >> bits) | (value << (32 - bits));
+		}
+
+		std::uint32_t load_be32(const std::uint8_t* data)
+		{
+			return (static_cast<std::uint32_t>(data[0]) << 24) | (static_cast<std::uint32_t>(data[1]) << 16) |
+				(static_cast<std::uint32_t>(data[2]) << 8) | static_cast<std::uint32_t>(data[3]);
+		}
+
+		void transform_generic(std::uint32_t state[8], const std::uint8_t* data, std::size_t blocks)
+		{
+			std::uint32_t w[64];
+
+			while (blocks--)
+			{
+				for (auto i = 0; i < 16; ++i)
+				{
+					w[i] = load_be32(data + i * 4);
+				}
+
+				for (auto i = 16; i < 64; ++i)
+				{
+					const auto s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+					const auto s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+					w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+				}
+
+				auto a = state[0], b = state[1], c = state[2], d = state[3];
+				auto e = state[4], f = state[5], g = state[6], h = state[7];
+
+				for (auto i = 0; i < 64; ++i)
+				{
+					const auto t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+					const auto t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+					h = g;
+					g = f;
+					f = e;
+					e = d + t1;
+					d = c;
+					c = b;
+					b = a;
+					a = t1 + t2;
+				}
+
+				state[0] += a;
+				state[1] += b;
+				state[2] += c;
+				state[3] += d;
+				state[4] += e;
+				state[5] += f;
+				state[6] += g;
+				state[7] += h;
+
+				data += BLOCK_SIZE;
+			}
+		}
+
+#ifdef SHA256_X86
+		// The SHA extensions keep the state as ABEF/CDGH and process four rounds per pair of sha256rnds2.
+		// Each group is instantiated separately so the message schedule stays in registers
+		template <int Group>
+		SHA256_TARGET("sha,ssse3,sse4.1") SHA256_INLINE
+		void sha_ni_group(__m128i& state0, __m128i& state1, __m128i msg[4], const std::uint8_t* data)
+		{
+			auto& current = msg[Group % 4];
+			auto& next = msg[(Group + 1) % 4];
+			auto& previous = msg[(Group + 3) % 4];
+
+			if constexpr (Group < 4)
+			{
+				const auto byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+				current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + Group * 16));
+				current = _mm_shuffle_epi8(current, byte_swap);
+			}
+
+			auto rounds = _mm_add_epi32(current, _mm_load_si128(reinterpret_cast<const __m128i*>(&K[Group * 4])));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, rounds);
+
+			if constexpr (Group >= 3 && Group < 15)
+			{
+				next = _mm_add_epi32(next, _mm_alignr_epi8(current, previous, 4));
+				next = _mm_sha256msg2_epu32(next, current);
+			}
+
+			rounds = _mm_shuffle_epi32(rounds, 0x0E);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, rounds);
+
+			if constexpr (Group >= 1 && Group < 13)
+			{
+				previous = _mm_sha256msg1_epu32(previous, current);
+			}
+		}
+
+		template <int... Groups>
+		SHA256_TARGET("sha,ssse3,sse4.1") SHA256_INLINE
+		void sha_ni_block(__m128i& state0, __m128i& state1, const std::uint8_t* data, std::integer_sequence<int, Groups...>)
+		{
+			__m128i msg[4];
+			(sha_ni_group<Groups>(state0, state1, msg, data), ...);
+		}
+
+		SHA256_TARGET("sha,ssse3,sse4.1")
+		void transform_sha_ni(std::uint32_t state[8], const std::uint8_t* data, std::size_t blocks)
+		{
+			auto tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0]));
+			auto state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4]));
+
+			tmp = _mm_shuffle_epi32(tmp, 0xB1); // CDAB
+			state1 = _mm_shuffle_epi32(state1, 0x1B); // EFGH
+			auto state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+			state1 = _mm_blend_epi16(state1, tmp, 0xF0); // CDGH
+
+			while (blocks--)
+			{
+				const auto abef = state0;
+				const auto cdgh = state1;
+
+				sha_ni_block(state0, state1, data, std::make_integer_sequence<int, 16>{});
+
+				state0 = _mm_add_epi32(state0, abef);
+				state1 = _mm_add_epi32(state1, cdgh);
+
+				data += BLOCK_SIZE;
+			}
+
+			tmp = _mm_shuffle_epi32(state0, 0x1B); // FEBA
+			state1 = _mm_shuffle_epi32(state1, 0xB1); // DCHG
+			state0 = _mm_blend_epi16(tmp, state1, 0xF0); // DCBA
+			state1 = _mm_alignr_epi8(state1, tmp, 8); // HGFE
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+		}
+#endif
+
+#ifdef SHA256_ARM64
+#if defined(__clang__)
+#define SHA256_ARM64_TARGET SHA256_TARGET("sha2")
+#else
+#define SHA256_ARM64_TARGET SHA256_TARGET("+crypto")
+#endif
+
+		template <int Group>
+		SHA256_ARM64_TARGET SHA256_INLINE
+		void arm64_group(uint32x4_t& state0, uint32x4_t& state1, uint32x4_t msg[4])
+		{
+			auto& current = msg[Group % 4];
+			const auto rounds = vaddq_u32(current, vld1q_u32(&K[Group * 4]));
+
+			if constexpr (Group < 12)
+			{
+				current = vsha256su0q_u32(current, msg[(Group + 1) % 4]);
+			}
+
+			const auto previous_state = state0;
+			state0 = vsha256hq_u32(state0, state1, rounds);
+			state1 = vsha256h2q_u32(state1, previous_state, rounds);
+
+			if constexpr (Group < 12)
+			{
+				current = vsha256su1q_u32(current, msg[(Group + 2) % 4], msg[(Group + 3) % 4]);
+			}
+		}
+
+		template <int... Groups>
+		SHA256_ARM64_TARGET SHA256_INLINE
+		void arm64_block(uint32x4_t& state0, uint32x4_t& state1, const std::uint8_t* data, std::integer_sequence<int, Groups...>)
+		{
+			uint32x4_t msg[4];
+			for (auto i = 0; i < 4; ++i)
+			{
+				msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+			}
+
+			(arm64_group<Groups>(state0, state1, msg), ...);
+		}
+
+		SHA256_ARM64_TARGET
+		void transform_arm64(std::uint32_t state[8], const std::uint8_t* data, std::size_t blocks)
+		{
+			auto state0 = vld1q_u32(&state[0]);
+			auto state1 = vld1q_u32(&state[4]);
+
+			while (blocks--)
+			{
+				const auto abcd = state0;
+				const auto efgh = state1;
+
+				arm64_block(state0, state1, data, std::make_integer_sequence<int, 16>{});
+
+				state0 = vaddq_u32(state0, abcd);
+				state1 = vaddq_u32(state1, efgh);
+
+				data += BLOCK_SIZE;
+			}
+
+			vst1q_u32(&state[0], state0);
+			vst1q_u32(&state[4], state1);
+		}
+#endif
+
+		struct implementation
+		{
+			kernel transform;
+			const char* name;
+		};
+
+		implementation select_implementation()
+		{
+#ifdef SHA256_X86
+			if (cpu::has_sha())
+			{
+				return {transform_sha_ni, "sha-ni"};
+			}
+#endif
+
+#ifdef SHA256_ARM64
+			if (cpu::has_arm_sha2())
+			{
+				return {transform_arm64, "armv8-sha2"};
+			}
+#endif
+
+			return {transform_generic, "generic"};
+		}
+
+		const implementation& get_selected()
+		{
+			static const auto selected = select_implementation();
+			return selected;
+		}
+	}
+
+	sha256::sha256()
+	{
+		this->reset();
+	}
+
+	void sha256::reset()
+	{
+		this->state_ = INITIAL_STATE;
+		this->buffered_ = 0;
+		this->size_ = 0;
+	}
+
+	std::uint64_t sha256::get_size() const
+	{
+		return this->size_;
+	}
+
+	void sha256::update(const void* data, std::size_t size)
+	{
+		const auto& transform = get_selected().transform;
+		const auto* bytes = static_cast<const std::uint8_t*>(data);
+
+		this->size_ += size;
+
+		if (this->buffered_)
+		{
+			const auto chunk = std::min(size, BLOCK_SIZE - this->buffered_);
+			std::memcpy(this->buffer_.data() + this->buffered_, bytes, chunk);
+
+			this->buffered_ += chunk;
+			bytes += chunk;
+			size -= chunk;
+
+			if (this->buffered_ < BLOCK_SIZE)
+			{
+				return;
+			}
+
+			transform(this->state_.data(), this->buffer_.data(), 1);
+			this->buffered_ = 0;
+		}
+
+		if (const auto blocks = size / BLOCK_SIZE)
+		{
+			transform(this->state_.data(), bytes, blocks);
+			bytes += blocks * BLOCK_SIZE;
+			size -= blocks * BLOCK_SIZE;
+		}
+
+		if (size)
+		{
+			std::memcpy(this->buffer_.data(), bytes, size);
+			this->buffered_ = size;
+		}
+	}
+
+	void sha256::update(const std::span<const std::byte> data)
+	{
+		this->update(data.data(), data.size());
+	}
+
+	sha256::digest sha256::finish()
+	{
+		const auto& transform = get_selected().transform;
+		const auto bits = this->size_ * 8;
+
+		this->buffer_[this->buffered_++] = 0x80;
+
+		if (this->buffered_ > BLOCK_SIZE - 8)
+		{
+			std::memset(this->buffer_.data() + this->buffered_, 0, BLOCK_SIZE - this->buffered_);
+			transform(this->state_.data(), this->buffer_.data(), 1);
+			this->buffered_ = 0;
+		}
+
+		std::memset(this->buffer_.data() + this->buffered_, 0, BLOCK_SIZE - 8 - this->buffered_);
+		for (auto i = 0; i < 8; ++i)
+		{
+			this->buffer_[BLOCK_SIZE - 1 - i] = static_cast<std::uint8_t>(bits >> (i * 8));
+		}
+
+		transform(this->state_.data(), this->buffer_.data(), 1);
+		this->buffered_ = 0;
+
+		digest result{};
+		for (std::size_t i = 0; i < this->state_.size(); ++i)
+		{
+			result[i * 4 + 0] = static_cast<std::uint8_t>(this->state_[i] >> 24);
+			result[i * 4 + 1] = static_cast<std::uint8_t>(this->state_[i] >> 16);
+			result[i * 4 + 2] = static_cast<std::uint8_t>(this->state_[i] >> 8);
+			result[i * 4 + 3] = static_cast<std::uint8_t>(this->state_[i]);
+		}
+
+		return result;
+	}
+
+	std::string sha256::finish_hex()
+	{
+		return to_hex(this->finish());
+	}
+
+	sha256::digest sha256::compute(const std::span<const std::byte> data)
+	{
+		sha256 hash{};
+		hash.update(data);
+		return hash.finish();
+	}
+
+	std::string sha256::to_hex(const digest& value)
+	{
+		static constexpr char digits[] = "0123456789abcdef";
+
+		std::string result{};
+		result.reserve(value.size() * 2);
+
+		for (const auto byte : value)
+		{
+			result.push_back(digits[byte >> 4]);
+			result.push_back(digits[byte & 0xF]);
+		}
+
+		return result;
+	}
+
+	const char* sha256::get_implementation()
+	{
+		return get_selected().name;
+	}
+}
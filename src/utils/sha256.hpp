@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+namespace utils
+{
+	// Incremental SHA-256. Uses the x86 SHA extensions or the ARMv8 SHA2 instructions when the CPU has them
+	class sha256
+	{
+	public:
+		using digest = std::array<std::uint8_t, 32>;
+
+		sha256();
+
+		void update(const void* data, std::size_t size);
+		void update(std::span<const std::byte> data);
+
+		// Pads the message and returns the digest. The object must be reset before it is used again
+		[[nodiscard]] digest finish();
+		[[nodiscard]] std::string finish_hex();
+
+		void reset();
+
+		[[nodiscard]] std::uint64_t get_size() const;
+
+		static digest compute(std::span<const std::byte> data);
+		static std::string to_hex(const digest& value);
+
+		// Name of the implementation picked for this CPU
+		static const char* get_implementation();
+
+	private:
+		std::array<std::uint32_t, 8> state_{};
+		std::array<std::uint8_t, 64> buffer_{};
+		std::size_t buffered_ = 0;
+		std::uint64_t size_ = 0;
+	};
+}
@@ -7,6 +7,46 @@
 
 namespace utils::string
 {
+	namespace
+	{
+		bool match_glob(std::string_view pattern, std::string_view path)
+		{
+			while (!pattern.empty())
+			{
+				if (pattern.front() == '*')
+				{
+					const auto any_depth = pattern.size() > 1 && pattern[1] == '*';
+					pattern.remove_prefix(any_depth ? 2 : 1);
+
+					for (std::size_t i = 0; i <= path.size(); ++i)
+					{
+						if (match_glob(pattern, path.substr(i)))
+						{
+							return true;
+						}
+
+						if (i < path.size() && path[i] == '/' && !any_depth)
+						{
+							return false;
+						}
+					}
+
+					return false;
+				}
+
+				if (path.empty() || (pattern.front() == '?' ? path.front() == '/' : pattern.front() != path.front()))
+				{
+					return false;
+				}
+
+				pattern.remove_prefix(1);
+				path.remove_prefix(1);
+			}
+
+			return path.empty();
+		}
+	}
+
 	const char* va(const char* fmt, ...)
 	{
 		static thread_local va_provider<8, 256> provider;
@@ -99,4 +139,14 @@ namespace utils::string
 
 		return str;
 	}
+
+	bool match_glob(const std::string& pattern, const std::string& path)
+	{
+		if (!pattern.empty() && pattern.back() == '/')
+		{
+			return match_glob(std::string_view(pattern + "**"), std::string_view(path));
+		}
+
+		return match_glob(std::string_view(pattern), std::string_view(path));
+	}
 }
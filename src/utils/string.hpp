@@ -90,4 +90,8 @@ namespace utils::string
 	std::string dump_hex(const std::string& data, const std::string& separator = " ");
 
 	std::string replace(std::string str, const std::string& from, const std::string& to);
+
+	// Matches a path against a glob. * and ? stay within a directory, ** spans any number of them.
+	// A pattern ending in / matches everything below that directory
+	bool match_glob(const std::string& pattern, const std::string& path);
 }